@@ -0,0 +1,299 @@
+/*
+Per-frame quality statistics. See analytics.h
+See main.cpp for license information.
+*/
+
+#include "analytics.h"
+
+#include <emmintrin.h>	// SSE2
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// 16 bit lane counters are flushed before they can overflow
+static const int COUNTER_FLUSH_ITERATIONS = 16384;
+
+// Sum of the unsigned 16 bit lanes of v, added into two 64 bit lanes of acc
+static inline __m128i SumU16(__m128i acc, __m128i v)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_and_si128(v, _mm_set1_epi16(0x00FF));
+	__m128i hi = _mm_srli_epi16(v, 8);
+	acc = _mm_add_epi64(acc, _mm_sad_epu8(lo, zero));
+	acc = _mm_add_epi64(acc, _mm_slli_epi64(_mm_sad_epu8(hi, zero), 8));
+	return acc;
+}
+
+static inline UINT64 HorizontalSum64(__m128i v)
+{
+	UINT64 lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), v);
+	return lanes[0] + lanes[1];
+}
+
+static inline UINT32 HorizontalSum16(__m128i v)
+{
+	UINT16 lanes[8];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), v);
+	UINT32 sum = 0;
+	for(int k = 0; k < 8; ++k)
+		sum += lanes[k];
+	return sum;
+}
+
+FrameAnalyzer::FrameAnalyzer()
+	: avgMean(0), avgSaturated(0), avgValid(0), avgChange(0), numFrames(0), numFlaggedInRow(0), totalTicks(0), maxTicks(0)
+{
+	memset(hist, 0, sizeof(hist));
+	memset(prevHist, 0, sizeof(prevHist));
+}
+
+void FrameAnalyzer::Accumulate(const UINT16 *frame, int numPixels, UINT64 *sum, UINT32 *zeros, UINT32 *saturated, UINT64 *absDiff)
+{
+	bool hasPrev = (int)prev.size() == numPixels;
+	if(!hasPrev)
+		prev.assign(frame, frame + numPixels);
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i ones = _mm_set1_epi16(-1);
+	__m128i sumV = zero, diffV = zero;
+	__m128i zeroCount = zero, satCount = zero;
+	UINT32 zeroTotal = 0, satTotal = 0;
+
+	UINT16 *prevBuf = &prev[0];
+	int p = 0;
+	int iterations = 0;
+	for(; p + 8 <= numPixels; p += 8)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + p));
+		__m128i pv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prevBuf + p));
+
+		sumV = SumU16(sumV, v);
+		diffV = SumU16(diffV, _mm_or_si128(_mm_subs_epu16(v, pv), _mm_subs_epu16(pv, v)));
+
+		// Masks are -1 per lane, so subtracting counts
+		zeroCount = _mm_sub_epi16(zeroCount, _mm_cmpeq_epi16(v, zero));
+		satCount = _mm_sub_epi16(satCount, _mm_cmpeq_epi16(v, ones));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(prevBuf + p), v);
+
+		if(++iterations == COUNTER_FLUSH_ITERATIONS) {
+			zeroTotal += HorizontalSum16(zeroCount);
+			satTotal += HorizontalSum16(satCount);
+			zeroCount = satCount = zero;
+			iterations = 0;
+		}
+	}
+	zeroTotal += HorizontalSum16(zeroCount);
+	satTotal += HorizontalSum16(satCount);
+
+	UINT64 sumTotal = HorizontalSum64(sumV);
+	UINT64 diffTotal = HorizontalSum64(diffV);
+
+	for(; p < numPixels; ++p)
+	{
+		UINT16 v = frame[p];
+		sumTotal += v;
+		diffTotal += (UINT64)abs((int)v - (int)prevBuf[p]);
+		zeroTotal += (v == 0);
+		satTotal += (v == 0xFFFF);
+		prevBuf[p] = v;
+	}
+
+	*sum = sumTotal;
+	*zeros = zeroTotal;
+	*saturated = satTotal;
+	*absDiff = diffTotal;
+}
+
+void FrameAnalyzer::AnalyzeDepth(const UINT16 *depth, int numPixels, FrameStats *stats)
+{
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+
+	UINT64 sum, absDiff;
+	UINT32 zeros, saturated;
+	Accumulate(depth, numPixels, &sum, &zeros, &saturated, &absDiff);
+
+	UINT32 valid = numPixels - zeros;
+	stats->mean = valid > 0 ? (float)((double)sum / valid) : 0.0f;
+	stats->saturated = 0;
+	stats->validRatio = (float)valid / numPixels;
+	stats->histDistance = 0;
+	stats->changeEnergy = (float)((double)absDiff / numPixels);
+	Flag(stats, numPixels);
+
+	Time(start.QuadPart);
+}
+
+void FrameAnalyzer::AnalyzeInfra(const UINT16 *infra, int numPixels, FrameStats *stats)
+{
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+
+	UINT64 sum, absDiff;
+	UINT32 zeros, saturated;
+	Accumulate(infra, numPixels, &sum, &zeros, &saturated, &absDiff);
+
+	// Histogram. Bins are computed 8 at a time, counting goes into 4 interleaved
+	// sub-histograms to avoid store-to-load stalls on runs of the same bin.
+	// SSE2 has no unsigned 16 bit min, v - saturate(v - max) clamps instead
+	UINT32 sub[4][ANALYTICS_HIST_BINS];
+	memset(sub, 0, sizeof(sub));
+	__m128i histMax = _mm_set1_epi16(ANALYTICS_HIST_MAX);
+	int p = 0;
+	for(; p + 8 <= numPixels; p += 8)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(infra + p));
+		v = _mm_sub_epi16(v, _mm_subs_epu16(v, histMax));
+		UINT16 bins[8];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(bins), _mm_srli_epi16(v, ANALYTICS_HIST_SHIFT));
+		++sub[0][bins[0]]; ++sub[1][bins[1]]; ++sub[2][bins[2]]; ++sub[3][bins[3]];
+		++sub[0][bins[4]]; ++sub[1][bins[5]]; ++sub[2][bins[6]]; ++sub[3][bins[7]];
+	}
+	for(; p < numPixels; ++p)
+		++sub[0][std::min((int)infra[p], ANALYTICS_HIST_MAX) >> ANALYTICS_HIST_SHIFT];
+
+	float histDistance = 0;
+	for(int b = 0; b < ANALYTICS_HIST_BINS; ++b)
+	{
+		hist[b] = sub[0][b] + sub[1][b] + sub[2][b] + sub[3][b];
+		histDistance += fabs((float)hist[b] - (float)prevHist[b]);
+		prevHist[b] = hist[b];
+	}
+
+	stats->mean = (float)((double)sum / numPixels);
+	stats->saturated = saturated;
+	stats->validRatio = 1.0f;
+	stats->histDistance = numFrames > 0 ? histDistance / numPixels : 0.0f;
+	stats->changeEnergy = (float)((double)absDiff / numPixels);
+	Flag(stats, numPixels);
+
+	Time(start.QuadPart);
+}
+
+void FrameAnalyzer::Flag(FrameStats *stats, int numPixels)
+{
+	stats->flags = 0;
+
+	if(numFrames == 0)
+		ResetAverages(stats);
+	else if(numFrames >= ANALYTICS_WARMUP_FRAMES) {
+		if(fabs(stats->mean - avgMean) > ANALYTICS_MEAN_JUMP_RATIO * avgMean)
+			stats->flags |= FLAG_MEAN_JUMP;
+		if(stats->saturated - avgSaturated > ANALYTICS_SATURATION_JUMP_RATIO * numPixels)
+			stats->flags |= FLAG_SATURATION_JUMP;
+		if(stats->histDistance > ANALYTICS_HIST_JUMP)
+			stats->flags |= FLAG_HISTOGRAM_JUMP;
+		if(fabs(stats->validRatio - avgValid) > ANALYTICS_VALID_JUMP)
+			stats->flags |= FLAG_VALID_JUMP;
+		if(stats->changeEnergy > ANALYTICS_CHANGE_JUMP_RATIO * avgChange + ANALYTICS_CHANGE_FLOOR)
+			stats->flags |= FLAG_CHANGE_SPIKE;
+	}
+
+	// Flashes must not drag the averages along with them. A change that outlasts any flash
+	// (lights switched on, sensor moved) would flag every frame after it, so it becomes the
+	// new baseline. Its first ANALYTICS_REBASELINE_FRAMES frames stay flagged
+	if(stats->flags != 0) {
+		if(++numFlaggedInRow >= ANALYTICS_REBASELINE_FRAMES) {
+			ResetAverages(stats);
+			numFlaggedInRow = 0;
+		}
+	}
+	else if(numFrames > 0) {
+		avgMean += ANALYTICS_EMA_ALPHA * (stats->mean - avgMean);
+		avgSaturated += ANALYTICS_EMA_ALPHA * (stats->saturated - avgSaturated);
+		avgValid += ANALYTICS_EMA_ALPHA * (stats->validRatio - avgValid);
+		avgChange += ANALYTICS_EMA_ALPHA * (stats->changeEnergy - avgChange);
+		numFlaggedInRow = 0;
+	}
+	++numFrames;
+}
+
+void FrameAnalyzer::ResetAverages(const FrameStats *stats)
+{
+	avgMean = stats->mean;
+	avgSaturated = (float)stats->saturated;
+	avgValid = stats->validRatio;
+	avgChange = stats->changeEnergy;
+}
+
+void FrameAnalyzer::Time(INT64 startTicks)
+{
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+	INT64 ticks = end.QuadPart - startTicks;
+	totalTicks += ticks;
+	maxTicks = std::max(maxTicks, ticks);
+}
+
+static double TicksToMs(INT64 ticks)
+{
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return ticks * 1000.0 / freq.QuadPart;
+}
+
+double FrameAnalyzer::AverageMs() const
+{
+	return numFrames > 0 ? TicksToMs(totalTicks) / numFrames : 0.0;
+}
+
+double FrameAnalyzer::MaxMs() const
+{
+	return TicksToMs(maxTicks);
+}
+
+std::vector<FlaggedSegment> FindFlaggedSegments(const FrameStats *stats, int numFrames, int maxGap)
+{
+	std::vector<FlaggedSegment> segments;
+	for(int i = 0; i < numFrames; ++i)
+	{
+		if(stats[i].flags == 0)
+			continue;
+
+		if(!segments.empty() && i - segments.back().lastFrame <= maxGap) {
+			FlaggedSegment &seg = segments.back();
+			seg.lastFrame = i;
+			seg.numFlagged++;
+			seg.flags |= stats[i].flags;
+		}
+		else {
+			FlaggedSegment seg;
+			seg.firstFrame = seg.lastFrame = i;
+			seg.numFlagged = 1;
+			seg.flags = stats[i].flags;
+			segments.push_back(seg);
+		}
+	}
+	return segments;
+}
+
+std::string FrameFlagsToString(UINT32 flags)
+{
+	static const char* names[] = { "mean", "saturation", "histogram", "valid", "change" };
+
+	std::string s;
+	for(int b = 0; b < 5; ++b)
+	{
+		if(flags & (1 << b)) {
+			if(!s.empty())
+				s += "|";
+			s += names[b];
+		}
+	}
+	return s.empty() ? "-" : s;
+}
+
+void WriteFrameStats(std::ostream &out, const FrameStats *stats, const TIMESPAN *times, int numFrames)
+{
+	out << "frame_idx" << "\t" << "RelativeTime" << "\t" << "mean" << "\t" << "saturated"
+		<< "\t" << "validRatio" << "\t" << "histDistance" << "\t" << "changeEnergy" << "\t" << "flags" << std::endl;
+	for(int i = 0; i < numFrames; ++i)
+	{
+		const FrameStats &s = stats[i];
+		out << i << "\t" << times[i] << "\t" << s.mean << "\t" << s.saturated << "\t" << s.validRatio
+			<< "\t" << s.histDistance << "\t" << s.changeEnergy << "\t" << FrameFlagsToString(s.flags) << "\n";
+	}
+	out.flush();
+}
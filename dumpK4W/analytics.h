@@ -0,0 +1,113 @@
+/*
+Cheap per-frame quality statistics for spotting flashing depth / IR (see foo.txt)
+in long captures without looking at the images.
+
+FrameAnalyzer is called from the capture threads right after a frame is copied
+from the sensor. One SSE2 pass over the frame computes the sums, counts and
+change against the previous frame; IR frames take a second pass for the
+histogram. Both together are well under 1ms for 512x424. Each stream needs
+its own FrameAnalyzer.
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+typedef INT64 TIMESPAN;	// As in Kinect.h
+
+// IR histogram. Amplitude clamped to ANALYTICS_HIST_MAX then >> ANALYTICS_HIST_SHIFT gives the bin.
+// Nearly all of a scene's IR is below 4096, brighter pixels all go in the last bin
+static const int ANALYTICS_HIST_BINS = 64;
+static const int ANALYTICS_HIST_SHIFT = 6;
+static const int ANALYTICS_HIST_MAX = (ANALYTICS_HIST_BINS << ANALYTICS_HIST_SHIFT) - 1;
+
+// Frames flagged as suspect when a statistic jumps away from its running average
+static const float ANALYTICS_EMA_ALPHA = 0.1f;				// Running average update rate
+static const int ANALYTICS_WARMUP_FRAMES = 5;				// No flags until the averages settle
+static const float ANALYTICS_MEAN_JUMP_RATIO = 0.25f;		// |mean - avg| > ratio * avg
+static const float ANALYTICS_SATURATION_JUMP_RATIO = 0.01f;	// saturated - avg > ratio * pixels
+static const float ANALYTICS_HIST_JUMP = 0.3f;				// L1 distance of normalised histograms (0..2)
+static const float ANALYTICS_VALID_JUMP = 0.05f;			// |validRatio - avg|
+static const float ANALYTICS_CHANGE_JUMP_RATIO = 3.0f;		// change > ratio * avg + floor
+static const float ANALYTICS_CHANGE_FLOOR = 5.0f;
+static const int ANALYTICS_REBASELINE_FRAMES = 30;			// A change lasting this many frames is the new normal
+
+// Flagged frames closer than this are merged into one segment in the report
+static const int ANALYTICS_SEGMENT_GAP_FRAMES = 15;
+
+enum FrameFlags
+{
+	FLAG_MEAN_JUMP			= 1 << 0,
+	FLAG_SATURATION_JUMP	= 1 << 1,
+	FLAG_HISTOGRAM_JUMP		= 1 << 2,
+	FLAG_VALID_JUMP			= 1 << 3,
+	FLAG_CHANGE_SPIKE		= 1 << 4
+};
+
+struct FrameStats
+{
+	float mean;				// IR: mean amplitude. Depth: mean of valid pixels in mm
+	UINT32 saturated;		// IR only: pixels at 65535
+	float validRatio;		// Depth only: non zero pixels / all pixels
+	float histDistance;		// IR only: change in histogram shape since previous frame
+	float changeEnergy;		// Mean |frame - previous frame| per pixel
+	UINT32 flags;			// FrameFlags
+};
+
+struct FlaggedSegment
+{
+	int firstFrame;
+	int lastFrame;
+	int numFlagged;
+	UINT32 flags;			// OR of all flags in the segment
+};
+
+class FrameAnalyzer
+{
+public:
+	FrameAnalyzer();
+
+	void AnalyzeDepth(const UINT16 *depth, int numPixels, FrameStats *stats);
+	void AnalyzeInfra(const UINT16 *infra, int numPixels, FrameStats *stats);
+
+	// Time spent in Analyze*() so far
+	double AverageMs() const;
+	double MaxMs() const;
+
+private:
+	// Shared SSE2 pass. Updates prev with frame.
+	void Accumulate(const UINT16 *frame, int numPixels, UINT64 *sum, UINT32 *zeros, UINT32 *saturated, UINT64 *absDiff);
+	void Flag(FrameStats *stats, int numPixels);
+	void Time(INT64 startTicks);
+
+	std::vector<UINT16> prev;
+	UINT32 hist[ANALYTICS_HIST_BINS];
+	UINT32 prevHist[ANALYTICS_HIST_BINS];
+
+	void ResetAverages(const FrameStats *stats);
+
+	// Running averages of stats from unflagged frames
+	float avgMean;
+	float avgSaturated;
+	float avgValid;
+	float avgChange;
+	int numFrames;
+	int numFlaggedInRow;
+
+	INT64 totalTicks;
+	INT64 maxTicks;
+};
+
+// Groups flagged frames into segments
+std::vector<FlaggedSegment> FindFlaggedSegments(const FrameStats *stats, int numFrames, int maxGap);
+
+// e.g. "mean|change"
+std::string FrameFlagsToString(UINT32 flags);
+
+// Tab separated per-frame table, same layout as the *_times.txt files plus stats
+void WriteFrameStats(std::ostream &out, const FrameStats *stats, const TIMESPAN *times, int numFrames);
@@ -0,0 +1,912 @@
+/*
+Synthetic source benchmarks. See benchmarks.h
+See main.cpp for license information.
+*/
+
+#include "benchmarks.h"
+#include "framering.h"
+#include "synthetic.h"
+#include "spscqueue.h"
+#include "iosched.h"
+#include "tiffwriter.h"
+#include "dumpreader.h"
+#include "colorconv.h"
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+
+using std::cout;
+using std::endl;
+
+INT64 NowTicks()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+double TicksToUs(INT64 ticks)
+{
+	static INT64 freq = 0;
+	if(freq == 0) {
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		freq = f.QuadPart;
+	}
+	return ticks * 1000000.0 / freq;
+}
+
+double Percentile(std::vector<double> &values, double p)
+{
+	if(values.empty())
+		return 0.0;
+	std::sort(values.begin(), values.end());
+	size_t idx = (size_t)(p / 100.0 * (values.size() - 1) + 0.5);
+	return values[std::min(idx, values.size() - 1)];
+}
+
+void PaceFrame(INT64 startTicks, int frameIdx, double fps)
+{
+	double dueUs = frameIdx * 1000000.0 / fps;
+	for(;;)
+	{
+		double remainingUs = dueUs - TicksToUs(NowTicks() - startTicks);
+		if(remainingUs <= 0)
+			return;
+		// Sleep() is coarse, so spin the last ms
+		if(remainingUs > 2000)
+			Sleep((DWORD)(remainingUs / 1000) - 1);
+		else
+			std::this_thread::yield();
+	}
+}
+
+// Reads of frame data are added in here so they are not optimised away
+static volatile UINT32 benchmarkSink = 0;
+
+// ---- Live ring latency ----
+
+// Budget: readers keep up at 30 FPS and the writer isn't slowed down
+static const double LIVE_MAX_P99_PUBLISH_PERIODS = 0.1;		// p99 Publish() cost, in frame periods
+static const double LIVE_MAX_P99_LATENCY_PERIODS = 0.25;	// p99 publish -> reader, in frame periods
+static const INT64 LIVE_MAX_DROPPED_FRAMES = 0;			// Dropped or torn, over all readers of a stream
+
+struct LiveStreamResult
+{
+	std::vector<double> publishUs;
+	std::vector<double> latencyUs;
+	INT64 published;
+	INT64 received;
+	INT64 dropped;
+	INT64 torn;
+};
+
+// Prints one budget check and returns isOk
+static bool BenchCheck(const char *what, bool isOk)
+{
+	cout << "  " << (isOk ? "PASS " : "FAIL ") << what << endl;
+	return isOk;
+}
+
+static void PrintLiveResult(const char *name, LiveStreamResult &r)
+{
+	cout << name << ": published " << r.published << ", received " << r.received
+		<< ", dropped " << r.dropped << ", torn " << r.torn << endl;
+	cout << "  publish us   p50 " << Percentile(r.publishUs, 50) << "  p99 " << Percentile(r.publishUs, 99)
+		<< "  max " << Percentile(r.publishUs, 100) << endl;
+	cout << "  latency us   p50 " << Percentile(r.latencyUs, 50) << "  p99 " << Percentile(r.latencyUs, 99)
+		<< "  max " << Percentile(r.latencyUs, 100) << endl;
+}
+
+bool RunLiveLatencyBenchmark(int seconds, int readersPerStream)
+{
+	static const wchar_t* names[3] = { L"Local\\dumpK4W_bench_depth", L"Local\\dumpK4W_bench_infra"
+		, L"Local\\dumpK4W_bench_color" };
+	static const char* labels[3] = { "Depth", "Infra", "Color" };
+
+	cout << "Live ring latency benchmark: " << seconds << "s at 30 FPS, "
+		<< readersPerStream << " reader(s) per stream" << endl;
+
+	SyntheticSource source;
+	const int numFrames = seconds * 30;
+
+	FrameRingWriter writers[3];
+	bool ok = writers[0].Create(names[0], SYNTHETIC_WIDTH, SYNTHETIC_HEIGHT, 2, LIVE_RING_DEFAULT_SLOTS)
+		&& writers[1].Create(names[1], SYNTHETIC_WIDTH, SYNTHETIC_HEIGHT, 2, LIVE_RING_DEFAULT_SLOTS)
+		&& writers[2].Create(names[2], SYNTHETIC_COLOR_WIDTH, SYNTHETIC_COLOR_HEIGHT, 2, LIVE_RING_DEFAULT_SLOTS);
+	if(!ok) {
+		std::cerr << "Unable to create benchmark rings" << endl;
+		return false;
+	}
+
+	LiveStreamResult results[3];
+	for(int s = 0; s < 3; ++s)
+		results[s].published = results[s].received = results[s].dropped = results[s].torn = 0;
+	std::mutex resultMutex;
+	std::atomic<bool> stop(false);
+
+	// Readers first so they see every frame
+	std::vector<std::thread> readers;
+	for(int s = 0; s < 3; ++s)
+	{
+		for(int r = 0; r < readersPerStream; ++r)
+		{
+			readers.push_back(std::thread([&, s]() {
+				FrameRingReader reader;
+				if(!reader.Open(names[s])) {
+					std::cerr << "Reader could not open " << labels[s] << endl;
+					return;
+				}
+
+				std::vector<double> latencies;
+				INT64 received = 0, torn = 0;
+				UINT32 checksum = 0;
+				FrameView view;
+				while(!stop) {
+					if(!reader.Next(&view, 100))
+						continue;
+					INT64 now = NowTicks();
+
+					// Touching the frame like a real consumer would
+					const BYTE *data = static_cast<const BYTE*>(view.data);
+					checksum += data[0] + data[view.bytes / 2] + data[view.bytes - 1];
+
+					if(!reader.IsValid(view)) {
+						++torn;
+						continue;
+					}
+					latencies.push_back(TicksToUs(now - view.publishTicks));
+					++received;
+				}
+
+				std::lock_guard<std::mutex> lock(resultMutex);
+				LiveStreamResult &res = results[s];
+				res.latencyUs.insert(res.latencyUs.end(), latencies.begin(), latencies.end());
+				res.received += received;
+				res.dropped += reader.Dropped();
+				res.torn += torn;
+				benchmarkSink += checksum;
+			}));
+		}
+	}
+	Sleep(100);
+
+	// One publishing thread per stream, like the capture threads
+	INT64 startTicks = NowTicks();
+	std::vector<std::thread> publishers;
+	for(int s = 0; s < 3; ++s)
+	{
+		publishers.push_back(std::thread([&, s]() {
+			std::vector<double> publishUs;
+			publishUs.reserve(numFrames);
+			for(int i = 0; i < numFrames; ++i)
+			{
+				PaceFrame(startTicks, i, 30.0);
+
+				const void *data;
+				UINT32 bytes;
+				if(s == 0) { data = source.Depth(i); bytes = SyntheticSource::DepthPixels() * 2; }
+				else if(s == 1) { data = source.Infra(i); bytes = SyntheticSource::DepthPixels() * 2; }
+				else { data = source.Color(i); bytes = SyntheticSource::ColorBytes(); }
+
+				INT64 t0 = NowTicks();
+				writers[s].Publish(data, bytes, SyntheticSource::RelativeTime(i));
+				publishUs.push_back(TicksToUs(NowTicks() - t0));
+			}
+
+			std::lock_guard<std::mutex> lock(resultMutex);
+			results[s].publishUs.swap(publishUs);
+			results[s].published = numFrames;
+		}));
+	}
+
+	for(size_t t = 0; t < publishers.size(); ++t)
+		publishers[t].join();
+	Sleep(200);	// Letting readers drain
+	stop = true;
+	for(size_t t = 0; t < readers.size(); ++t)
+		readers[t].join();
+
+	const double periodUs = 1000000.0 / 30;
+	bool isAllOk = true;
+	for(int s = 0; s < 3; ++s)
+	{
+		LiveStreamResult &r = results[s];
+		PrintLiveResult(labels[s], r);
+		bool isOk = BenchCheck("every reader got every frame", r.received == r.published * readersPerStream 
+			&& r.dropped + r.torn <= LIVE_MAX_DROPPED_FRAMES);
+		isOk = BenchCheck("p99 publish cost", Percentile(r.publishUs, 99) <= LIVE_MAX_P99_PUBLISH_PERIODS * periodUs) && isOk;
+		isOk = BenchCheck("p99 latency", Percentile(r.latencyUs, 99) <= LIVE_MAX_P99_LATENCY_PERIODS * periodUs) && isOk;
+		isAllOk = isAllOk && isOk;
+	}
+	cout << "LIVE LATENCY TEST " << (isAllOk ? "PASSED" : "FAILED") << endl;
+	return isAllOk;
+}
+
+// ---- Capture models (thread per stream vs reactor) ----
+
+static const int BENCH_STREAMS = 3;
+static const int BENCH_QUEUE_FRAMES = 256;
+static const DWORD BENCH_UI_SLEEP_MS = 1;		// Stand-in for waitKey(1)
+static const DWORD BENCH_UI_PERIOD_MS = 33;		// Reactor: waitKey(1) at most this often, like REACTOR_UI_MS
+
+// Stands in for the SDK side of one stream: the newest frame plus an auto-reset
+// frame arrived event. Frames not copied before the next one arrives are lost.
+struct EmulatedSensor
+{
+	HANDLE event;
+	std::mutex mutex;
+	int latest;					// Newest frame, -1 = none yet
+	INT64 arrivalTicks;			// When latest was signalled
+	const void *data;
+	UINT32 bytes;
+};
+
+struct CaptureModelResult
+{
+	INT64 wakeups;
+	INT64 copied;
+	INT64 dropped;
+	std::vector<double> copyLatencyUs;		// Frame arrived -> copied
+	std::vector<double> processLatencyUs;	// Frame arrived -> processed
+};
+
+// A frame copied out of an EmulatedSensor
+struct BenchFrame
+{
+	int stream;
+	int frameIdx;
+	INT64 arrivalTicks;
+	INT64 copiedTicks;
+};
+
+// Copies the newest frame of sensor into buf, like CopyArrivedFrame(). Returns its index, -1 if none
+static int CopyFromSensor(EmulatedSensor &sensor, BYTE *buf, INT64 *arrivalTicks)
+{
+	std::lock_guard<std::mutex> lock(sensor.mutex);
+	if(sensor.latest < 0)
+		return -1;
+	memcpy(buf, sensor.data, sensor.bytes);
+	*arrivalTicks = sensor.arrivalTicks;
+	return sensor.latest;
+}
+
+// Stand-in for ProcessFrame(): reads the frame like analytics would
+static void ProcessBenchFrame(const BYTE *buf, UINT32 bytes)
+{
+	UINT32 sum = 0;
+	for(UINT32 b = 0; b < bytes; b += 4096)
+		sum += buf[b];
+	benchmarkSink += sum;
+}
+
+// Signals frames of all streams at 30 FPS until numFrames per stream are out
+static void RunEmulatedSensors(EmulatedSensor *sensors, const SyntheticSource &source, int numFrames, INT64 startTicks)
+{
+	for(int i = 0; i < numFrames; ++i)
+	{
+		PaceFrame(startTicks, i, 30.0);
+		for(int s = 0; s < BENCH_STREAMS; ++s)
+		{
+			EmulatedSensor &sensor = sensors[s];
+			{
+				std::lock_guard<std::mutex> lock(sensor.mutex);
+				sensor.latest = i;
+				sensor.arrivalTicks = NowTicks();
+				sensor.data = s == 0 ? (const void*)source.Depth(i) : s == 1 ? (const void*)source.Infra(i) 
+					: (const void*)source.Color(i);
+			}
+			SetEvent(sensor.event);
+		}
+	}
+}
+
+static void PrintCaptureModelResult(const char *name, CaptureModelResult &r, int seconds)
+{
+	cout << name << ": " << r.wakeups << " wakeups (" << r.wakeups / (double)seconds << "/s), copied " 
+		<< r.copied << ", dropped " << r.dropped << endl;
+	cout << "  arrival->copied us     p50 " << Percentile(r.copyLatencyUs, 50) << "  p99 " 
+		<< Percentile(r.copyLatencyUs, 99) << "  max " << Percentile(r.copyLatencyUs, 100) << endl;
+	cout << "  arrival->processed us  p50 " << Percentile(r.processLatencyUs, 50) << "  p99 " 
+		<< Percentile(r.processLatencyUs, 99) << "  max " << Percentile(r.processLatencyUs, 100) << endl;
+}
+
+// Records a copied and processed frame. Repeats (the same frame copied twice) are ignored
+static void RecordFrame(const BenchFrame &frame, INT64 processedTicks, int *lastCopied, CaptureModelResult *result)
+{
+	if(frame.frameIdx == lastCopied[frame.stream])
+		return;
+	result->dropped += frame.frameIdx - lastCopied[frame.stream] - 1;
+	lastCopied[frame.stream] = frame.frameIdx;
+	++result->copied;
+	result->copyLatencyUs.push_back(TicksToUs(frame.copiedTicks - frame.arrivalTicks));
+	result->processLatencyUs.push_back(TicksToUs(processedTicks - frame.arrivalTicks));
+}
+
+static void RunCaptureModel(bool isReactor, int seconds, const SyntheticSource &source, CaptureModelResult *result)
+{
+	const int numFrames = seconds * 30;
+	const UINT32 sizes[BENCH_STREAMS] = { (UINT32)SyntheticSource::DepthPixels() * 2, (UINT32)SyntheticSource::DepthPixels() * 2
+		, (UINT32)SyntheticSource::ColorBytes() };
+
+	EmulatedSensor sensors[BENCH_STREAMS];
+	std::vector<BYTE> buffers[BENCH_STREAMS];
+	for(int s = 0; s < BENCH_STREAMS; ++s)
+	{
+		sensors[s].event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		sensors[s].latest = -1;
+		sensors[s].arrivalTicks = 0;
+		sensors[s].data = NULL;
+		sensors[s].bytes = sizes[s];
+		buffers[s].resize(sizes[s]);
+	}
+
+	result->wakeups = result->copied = result->dropped = 0;
+	result->copyLatencyUs.reserve(numFrames * BENCH_STREAMS);
+	result->processLatencyUs.reserve(numFrames * BENCH_STREAMS);
+	int lastCopied[BENCH_STREAMS] = { -1, -1, -1 };
+	std::mutex resultMutex;
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> threads;
+
+	SpscQueue<BenchFrame> queue(BENCH_QUEUE_FRAMES);
+	HANDLE workEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	std::atomic<bool> isReactorDone(false);
+
+	if(!isReactor)
+	{
+		// Like ProcessStream(): wait, copy, process, waitKey(1)
+		for(int s = 0; s < BENCH_STREAMS; ++s)
+		{
+			threads.push_back(std::thread([&, s]() {
+				INT64 wakeups = 0;
+				while(!stop)
+				{
+					DWORD ret = WaitForSingleObject(sensors[s].event, 200);
+					++wakeups;
+					if(ret == WAIT_OBJECT_0) {
+						BenchFrame frame;
+						frame.stream = s;
+						frame.frameIdx = CopyFromSensor(sensors[s], &buffers[s][0], &frame.arrivalTicks);
+						frame.copiedTicks = NowTicks();
+						if(frame.frameIdx >= 0) {
+							ProcessBenchFrame(&buffers[s][0], sizes[s]);
+							INT64 processedTicks = NowTicks();
+							std::lock_guard<std::mutex> lock(resultMutex);
+							RecordFrame(frame, processedTicks, lastCopied, result);
+						}
+					}
+					Sleep(BENCH_UI_SLEEP_MS);
+					++wakeups;
+				}
+				std::lock_guard<std::mutex> lock(resultMutex);
+				result->wakeups += wakeups;
+			}));
+		}
+	}
+	else
+	{
+		// Like ReactorCapture(): one thread copies in arrival order and queues
+		threads.push_back(std::thread([&]() {
+			HANDLE handles[BENCH_STREAMS];
+			for(int s = 0; s < BENCH_STREAMS; ++s)
+				handles[s] = sensors[s].event;
+			INT64 wakeups = 0;
+			while(!stop)
+			{
+				DWORD ret = WaitForMultipleObjects(BENCH_STREAMS, handles, FALSE, 200);
+				++wakeups;
+				if(ret < WAIT_OBJECT_0 || ret >= WAIT_OBJECT_0 + BENCH_STREAMS)
+					continue;
+				BenchFrame frame;
+				frame.stream = (int)(ret - WAIT_OBJECT_0);
+				frame.frameIdx = CopyFromSensor(sensors[frame.stream], &buffers[frame.stream][0], &frame.arrivalTicks);
+				frame.copiedTicks = NowTicks();
+				if(frame.frameIdx < 0)
+					continue;
+				while(!queue.Push(frame))
+					std::this_thread::yield();
+				SetEvent(workEvent);
+			}
+			{
+				std::lock_guard<std::mutex> lock(resultMutex);
+				result->wakeups += wakeups;
+			}
+			isReactorDone = true;
+			SetEvent(workEvent);
+		}));
+
+		// Like ReactorCaptureAll(): one thread processes, with waitKey(1) at most every UI period.
+		// Buffers are not double buffered here, so a frame read may be newer than the one
+		// queued. Only the timing matters.
+		threads.push_back(std::thread([&]() {
+			INT64 wakeups = 0;
+			INT64 lastUiTicks = NowTicks();
+			for(;;)
+			{
+				WaitForSingleObject(workEvent, BENCH_UI_PERIOD_MS);
+				++wakeups;
+				bool isDone = isReactorDone;
+				BenchFrame frame;
+				while(queue.Pop(&frame))
+				{
+					ProcessBenchFrame(&buffers[frame.stream][0], sizes[frame.stream]);
+					INT64 processedTicks = NowTicks();
+					std::lock_guard<std::mutex> lock(resultMutex);
+					RecordFrame(frame, processedTicks, lastCopied, result);
+				}
+				if(isDone)
+					break;
+				if(TicksToUs(NowTicks() - lastUiTicks) >= BENCH_UI_PERIOD_MS * 1000) {
+					Sleep(BENCH_UI_SLEEP_MS);
+					++wakeups;
+					lastUiTicks = NowTicks();
+				}
+			}
+			std::lock_guard<std::mutex> lock(resultMutex);
+			result->wakeups += wakeups;
+		}));
+	}
+
+	Sleep(100);
+	RunEmulatedSensors(sensors, source, numFrames, NowTicks());
+	Sleep(200);	// Letting the last frames through
+	stop = true;
+	for(size_t t = 0; t < threads.size(); ++t)
+		threads[t].join();
+
+	// Frames never copied at the end count as dropped too
+	for(int s = 0; s < BENCH_STREAMS; ++s)
+	{
+		result->dropped += numFrames - 1 - lastCopied[s];
+		CloseHandle(sensors[s].event);
+	}
+	CloseHandle(workEvent);
+}
+
+void RunReactorBenchmark(int seconds)
+{
+	cout << "Capture model benchmark: " << seconds << "s each, depth + infra + color at 30 FPS" << endl;
+
+	SyntheticSource source;
+	CaptureModelResult threadPerStream, reactor;
+	RunCaptureModel(false, seconds, source, &threadPerStream);
+	RunCaptureModel(true, seconds, source, &reactor);
+
+	PrintCaptureModelResult("Thread per stream", threadPerStream, seconds);
+	PrintCaptureModelResult("Reactor", reactor, seconds);
+}
+
+// ---- Dump I/O (one writer per stream vs I/O scheduler) ----
+
+static const int IO_BENCH_STREAMS = 3;					// Writer threads: depth, infra, color
+static const DWORD IO_BENCH_SEQUENTIAL_CHUNK = 8 * 1024 * 1024;
+
+// One kind of dump file with its image for each distinct synthetic frame. The writers encode
+// them while timed, like the dump does
+struct IoBenchKind
+{
+	int stream;			// Writer thread that produces it
+	const char *prefix;
+	std::vector<cv::Mat> frames;
+};
+
+struct IoBenchRun
+{
+	const std::vector<IoBenchKind> *kinds;
+	std::string path;
+	int numFrames;
+	IoScheduler *io;	// NULL => write directly, like the old dump
+	std::mutex mutex;
+	std::vector<std::string> filenames;
+	int errors;
+};
+
+static std::string IoBenchFilename(const std::string &path, const char *prefix, int i, const char *extension)
+{
+	std::stringstream filename;
+	filename << path << prefix;
+	filename.width(8);
+	filename.fill('0');
+	filename << i << extension;
+	return filename.str();
+}
+
+// Creates filename and writes data with one synchronous WriteFile
+static bool WriteWholeFile(const std::string &filename, const BYTE *data, DWORD bytes)
+{
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS
+		, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD written = 0;
+	BOOL ok = WriteFile(file, data, bytes, &written, NULL);
+	CloseHandle(file);
+	return ok && written == bytes;
+}
+
+// One writer thread of the dump: encodes and writes the files of stream for every frame.
+// Through the scheduler that is SaveImage(), the same call the dump makes
+static void IoBenchWriter(IoBenchRun *run, int stream)
+{
+	const std::vector<IoBenchKind> &kinds = *run->kinds;
+	std::vector<BYTE> data;
+	for(int i = 0; i < run->numFrames; ++i)
+	{
+		for(size_t k = 0; k < kinds.size(); ++k)
+		{
+			if(kinds[k].stream != stream)
+				continue;
+			const cv::Mat &image = kinds[k].frames[i % kinds[k].frames.size()];
+			std::string filename = IoBenchFilename(run->path, kinds[k].prefix, i, ".tiff");
+			bool isOk = true;
+			if(run->io)
+				SaveImage(run->io, filename.c_str(), image);
+			else
+				isOk = EncodeTiff(image, data) && WriteWholeFile(filename, &data[0], (DWORD)data.size());
+
+			std::lock_guard<std::mutex> lock(run->mutex);
+			run->filenames.push_back(filename);
+			if(!isOk)
+				++run->errors;
+		}
+	}
+}
+
+// Returns seconds taken to write all files
+static double RunIoBenchWriters(IoBenchRun *run)
+{
+	run->errors = 0;
+	INT64 startTicks = NowTicks();
+	if(run->io)
+		run->io->Start(true, TiffMaxBytes(SYNTHETIC_WIDTH, SYNTHETIC_HEIGHT, 3));
+	std::vector<std::thread> writers;
+	for(int s = 0; s < IO_BENCH_STREAMS; ++s)
+		writers.push_back(std::thread(&IoBenchWriter, run, s));
+	for(size_t t = 0; t < writers.size(); ++t)
+		writers[t].join();
+	if(run->io) {
+		run->io->Finish();
+		run->errors += run->io->Errors();
+	}
+	return TicksToUs(NowTicks() - startTicks) / 1000000;
+}
+
+static void DeleteIoBenchFiles(IoBenchRun *run)
+{
+	for(size_t f = 0; f < run->filenames.size(); ++f)
+		DeleteFileA(run->filenames[f].c_str());
+	run->filenames.clear();
+}
+
+static void PrintIoBenchResult(const char *name, double bytes, int files, double sec, double sequentialSec)
+{
+	cout << name << ": " << sec << "s, " << bytes / 1024 / 1024 / sec << " MB/s, " << files / sec << " files/s";
+	if(sequentialSec > 0)
+		cout << " (" << 100 * sequentialSec / sec << "% of sequential)";
+	cout << endl;
+}
+
+bool RunIoBenchmark(int seconds, const std::string &path)
+{
+	std::wstring widePath;
+	widePath.assign(path.begin(), path.end());
+	if(!CreateDirectory(widePath.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+		std::cerr << "Unable to create " << path << endl;
+		return false;
+	}
+
+	// What the dump writes without -u -y: depth, infra, grayMapped and rgbMapped tiffs
+	SyntheticSource source;
+	std::vector<IoBenchKind> kinds(4);
+	const char *prefixes[4] = { "depth", "infra", "grayMapped", "rgbMapped" };
+	for(int k = 0; k < 4; ++k)
+	{
+		kinds[k].stream = std::min(k, 2);
+		kinds[k].prefix = prefixes[k];
+		kinds[k].frames.resize(SYNTHETIC_DEFAULT_DISTINCT_FRAMES);
+	}
+	std::vector<BYTE> encoded;
+	double frameSetBytes = 0;
+	for(int i = 0; i < SYNTHETIC_DEFAULT_DISTINCT_FRAMES; ++i)
+	{
+		cv::Mat gray(SYNTHETIC_HEIGHT, SYNTHETIC_WIDTH, CV_8UC1), rgb(SYNTHETIC_HEIGHT, SYNTHETIC_WIDTH, CV_8UC3);
+
+		// Stand-ins for the mapped color images: the top left of the color frame
+		const BYTE *color = source.Color(i);
+		for(int y = 0; y < SYNTHETIC_HEIGHT; ++y)
+			for(int x = 0; x < SYNTHETIC_WIDTH; ++x)
+			{
+				const BYTE *yuyv = color + (y * SYNTHETIC_COLOR_WIDTH + x) * 2;
+				gray.ptr<BYTE>(y)[x] = yuyv[0];
+				BYTE *bgr = rgb.ptr<BYTE>(y) + 3*x;
+				bgr[0] = bgr[1] = bgr[2] = yuyv[0];
+			}
+
+		kinds[0].frames[i] = cv::Mat(SYNTHETIC_HEIGHT, SYNTHETIC_WIDTH, CV_16UC1, const_cast<UINT16*>(source.Depth(i))).clone();
+		kinds[1].frames[i] = cv::Mat(SYNTHETIC_HEIGHT, SYNTHETIC_WIDTH, CV_16UC1, const_cast<UINT16*>(source.Infra(i))).clone();
+		kinds[2].frames[i] = gray;
+		kinds[3].frames[i] = rgb;
+	}
+	for(int k = 0; k < 4; ++k)
+	{
+		EncodeTiff(kinds[k].frames[0], encoded);
+		frameSetBytes += encoded.size();
+	}
+
+	const int numFrames = seconds * 30;
+	const int numFiles = numFrames * 4;
+	const double totalBytes = frameSetBytes * numFrames;
+	cout << "Dump I/O benchmark: " << numFiles << " files, " << totalBytes / 1024 / 1024 << "MB to " << path 
+		<< " (OS write cache bypassed)" << endl;
+
+	// Best case: the same bytes as one sequential file
+	std::string sequentialFilename = path + "sequential.bin";
+	std::vector<BYTE> chunk(IO_BENCH_SEQUENTIAL_CHUNK, 0x5A);
+	HANDLE file = CreateFileA(sequentialFilename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS
+		, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(file == INVALID_HANDLE_VALUE) {
+		std::cerr << "Unable to write " << sequentialFilename << endl;
+		return false;
+	}
+	INT64 startTicks = NowTicks();
+	bool isOk = true;
+	for(double left = totalBytes; left > 0 && isOk; left -= IO_BENCH_SEQUENTIAL_CHUNK)
+	{
+		DWORD bytes = (DWORD)std::min(left, (double)IO_BENCH_SEQUENTIAL_CHUNK);
+		DWORD written = 0;
+		isOk = WriteFile(file, &chunk[0], bytes, &written, NULL) && written == bytes;
+	}
+	CloseHandle(file);
+	double sequentialSec = TicksToUs(NowTicks() - startTicks) / 1000000;
+	DeleteFileA(sequentialFilename.c_str());
+
+	IoBenchRun perStream;
+	perStream.kinds = &kinds;
+	perStream.path = path;
+	perStream.numFrames = numFrames;
+	perStream.io = NULL;
+	double perStreamSec = RunIoBenchWriters(&perStream);
+	DeleteIoBenchFiles(&perStream);
+
+	IoScheduler scheduler;
+	IoBenchRun scheduled;
+	scheduled.kinds = &kinds;
+	scheduled.path = path;
+	scheduled.numFrames = numFrames;
+	scheduled.io = &scheduler;
+	double scheduledSec = RunIoBenchWriters(&scheduled);
+	DeleteIoBenchFiles(&scheduled);
+
+	PrintIoBenchResult("Sequential file", totalBytes, 1, sequentialSec, 0);
+	PrintIoBenchResult("One writer per stream", totalBytes, numFiles, perStreamSec, sequentialSec);
+	PrintIoBenchResult("I/O scheduler", totalBytes, numFiles, scheduledSec, sequentialSec);
+
+	int errors = perStream.errors + scheduled.errors + (isOk ? 0 : 1);
+	if(errors > 0)
+		cout << errors << " writes failed" << endl;
+	return errors == 0;
+}
+
+// ---- Dump reader ----
+
+static const int READER_BENCH_JUMPS = 20;
+
+static void PrintReaderResult(const char *name, std::vector<double> &getUs, int hits, int prefetchHits)
+{
+	cout << name << ": " << getUs.size() << " frames, " << hits << " cache hits (" << prefetchHits 
+		<< " prefetched), Get() us  p50 " << Percentile(getUs, 50) << "  p99 " << Percentile(getUs, 99) 
+		<< "  max " << Percentile(getUs, 100) << endl;
+}
+
+bool RunReaderBenchmark(int seconds, const std::string &path)
+{
+	std::wstring widePath;
+	widePath.assign(path.begin(), path.end());
+	if(!CreateDirectory(widePath.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+		std::cerr << "Unable to create " << path << endl;
+		return false;
+	}
+
+	// A -y dump of color only
+	SyntheticSource source;
+	const int numFrames = seconds * 30;
+	std::vector<std::string> filenames;
+	{
+		std::ofstream times((path + "color_times.txt").c_str());
+		times << "frame_idx" << "\t" << "RelativeTime" << endl;
+		for(int i = 0; i < numFrames; ++i)
+		{
+			std::string filename = IoBenchFilename(path, "yuyv", i, ".yuv");
+			FILE *file = fopen(filename.c_str(), "wb");
+			if(!file) {
+				std::cerr << "Unable to write " << filename << endl;
+				return false;
+			}
+			fwrite(source.Color(i), 1, SyntheticSource::ColorBytes(), file);
+			fclose(file);
+			filenames.push_back(filename);
+			times << i << "\t" << SyntheticSource::RelativeTime(i) << endl;
+		}
+	}
+	filenames.push_back(path + "color_times.txt");
+
+	DumpReader reader;
+	if(!reader.Open(path)) {
+		std::cerr << "Unable to open " << path << endl;
+		return false;
+	}
+	cout << "Dump reader benchmark: " << numFrames << " rgb frames from YUY2, cache " 
+		<< DUMP_READER_DEFAULT_CACHE_BYTES / 1024 / 1024 << "MB, prefetch " << DUMP_READER_PREFETCH_FRAMES << endl;
+
+	// Forwards at 30 FPS, like playing the session back
+	std::vector<double> getUs;
+	INT64 startTicks = NowTicks();
+	for(int i = 0; i < numFrames; ++i)
+	{
+		PaceFrame(startTicks, i, 30.0);
+		INT64 t0 = NowTicks();
+		cv::Mat rgb = reader.Get(DUMP_RGB, i);
+		getUs.push_back(TicksToUs(NowTicks() - t0));
+		benchmarkSink += rgb.empty() ? 0 : rgb.data[0];
+	}
+	PrintReaderResult("Forwards at 30 FPS", getUs, reader.Hits(), reader.PrefetchHits());
+
+	// Back over the same frames as fast as possible: whatever is still cached
+	int hits = reader.Hits(), prefetchHits = reader.PrefetchHits();
+	getUs.clear();
+	for(int i = numFrames - 1; i >= 0; --i)
+	{
+		INT64 t0 = NowTicks();
+		cv::Mat rgb = reader.Get(DUMP_RGB, i);
+		getUs.push_back(TicksToUs(NowTicks() - t0));
+	}
+	PrintReaderResult("Backwards, no wait", getUs, reader.Hits() - hits, reader.PrefetchHits() - prefetchHits);
+
+	// Random jumps with nothing cached: the cost of a decode
+	reader.ClearCache();
+	hits = reader.Hits();
+	prefetchHits = reader.PrefetchHits();
+	getUs.clear();
+	for(int j = 0; j < READER_BENCH_JUMPS; ++j)
+	{
+		int i = (j * 7919) % numFrames;
+		INT64 t0 = NowTicks();
+		cv::Mat rgb = reader.Get(DUMP_RGB, i);
+		getUs.push_back(TicksToUs(NowTicks() - t0));
+	}
+	PrintReaderResult("Random jumps, cold", getUs, reader.Hits() - hits, reader.PrefetchHits() - prefetchHits);
+
+	reader.Close();
+	for(size_t f = 0; f < filenames.size(); ++f)
+		DeleteFileA(filenames[f].c_str());
+	return true;
+}
+
+// ---- Mapped color ----
+
+static const int COLOR_BENCH_POINT_SETS = 4;	// Mapped coordinates differ a little between depth frames
+static const int COLOR_BENCH_INVALID_EVERY = 37;	// No depth => -inf, like ICoordinateMapper
+
+// Depth pixels spread over the middle of the color frame, the top and bottom rows out of it
+static void MakeBenchPoints(int set, std::vector<float> &points)
+{
+	const int W = SYNTHETIC_WIDTH, H = SYNTHETIC_HEIGHT;
+	const float offset = 0.37f + 0.25f * set;
+	points.resize(W * H * 2);
+	for(int v = 0; v < H; ++v)
+	{
+		for(int u = 0; u < W; ++u)
+		{
+			int j = v*W + u;
+			if(j % COLOR_BENCH_INVALID_EVERY == 0) {
+				points[2*j] = points[2*j + 1] = -std::numeric_limits<float>::infinity();
+				continue;
+			}
+			points[2*j] = SYNTHETIC_COLOR_WIDTH / 2 + (u - W / 2) * 2.93f + offset;
+			points[2*j + 1] = SYNTHETIC_COLOR_HEIGHT / 2 + (v - H / 2) * 2.93f - offset;
+		}
+	}
+}
+
+// The dump before YUY2SampleMapped(): whole frame to gray and BGR, then sampled
+static void LegacyMapColor(const BYTE *yuy2, const std::vector<float> &points, BYTE *grayBuf, BYTE *rgbBuf
+	, BYTE *grayMapped, BYTE *rgbMapped)
+{
+	const int CW = SYNTHETIC_COLOR_WIDTH, CH = SYNTHETIC_COLOR_HEIGHT;
+	const int numPoints = SyntheticSource::DepthPixels();
+	YUY2ToGray(yuy2, CW * CH, grayBuf);
+	YUY2ToBGR(yuy2, CW * CH, rgbBuf);
+
+	memset(grayMapped, 0, numPoints);
+	for(int j = 0; j < numPoints; ++j)
+	{
+		int x = static_cast<int>((double)points[2*j] + 0.5);
+		int y = static_cast<int>((double)points[2*j + 1] + 0.5);
+		if(x >= 0 && x < CW && y >= 0 && y < CH)
+			grayMapped[j] = grayBuf[y*CW + x];
+	}
+	memset(rgbMapped, 0, numPoints * 3);
+	for(int j = 0; j < numPoints; ++j)
+	{
+		int x = static_cast<int>((double)points[2*j] + 0.5);
+		int y = static_cast<int>((double)points[2*j + 1] + 0.5);
+		if(x >= 0 && x < CW && y >= 0 && y < CH) {
+			const BYTE *bgr = rgbBuf + 3*(y*CW + x);
+			rgbMapped[3*j] = bgr[0];
+			rgbMapped[3*j + 1] = bgr[1];
+			rgbMapped[3*j + 2] = bgr[2];
+		}
+	}
+}
+
+static void PrintColorResult(const char *name, int frames, double sec, size_t workspaceBytes)
+{
+	cout << name << ": " << frames << " frames, " << sec * 1000.0 / frames << " ms/frame, workspace " 
+		<< workspaceBytes / 1024 << "KB" << endl;
+}
+
+bool RunColorBenchmark(int seconds)
+{
+	const int CW = SYNTHETIC_COLOR_WIDTH, CH = SYNTHETIC_COLOR_HEIGHT;
+	const int numPoints = SyntheticSource::DepthPixels();
+
+	SyntheticSource source;
+	std::vector<float> points[COLOR_BENCH_POINT_SETS];
+	for(int s = 0; s < COLOR_BENCH_POINT_SETS; ++s)
+		MakeBenchPoints(s, points[s]);
+
+	std::vector<BYTE> grayBuf(CW * CH), rgbBuf(CW * CH * 3);
+	std::vector<BYTE> grayMapped(numPoints), rgbMapped(numPoints * 3);
+	std::vector<BYTE> fusedGray(numPoints), fusedRgb(numPoints * 3);
+
+	cout << "Mapped color benchmark: " << numPoints << " points from " << CW << "x" << CH << " YUY2, 1 in " 
+		<< COLOR_BENCH_INVALID_EVERY << " invalid and the top and bottom rows out of frame" << endl;
+
+	// Same pixels for every frame and coordinate set
+	int mismatches = 0;
+	for(int i = 0; i < SYNTHETIC_DEFAULT_DISTINCT_FRAMES; ++i)
+	{
+		const std::vector<float> &p = points[i % COLOR_BENCH_POINT_SETS];
+		LegacyMapColor(source.Color(i), p, &grayBuf[0], &rgbBuf[0], &grayMapped[0], &rgbMapped[0]);
+		YUY2SampleMapped(source.Color(i), CW, CH, &p[0], numPoints, &fusedGray[0], &fusedRgb[0]);
+		if(grayMapped != fusedGray || rgbMapped != fusedRgb)
+			++mismatches;
+	}
+
+	const double runUs = seconds * 1000000.0;
+	int legacyFrames = 0;
+	INT64 startTicks = NowTicks();
+	for(; TicksToUs(NowTicks() - startTicks) < runUs; ++legacyFrames)
+	{
+		LegacyMapColor(source.Color(legacyFrames), points[legacyFrames % COLOR_BENCH_POINT_SETS]
+			, &grayBuf[0], &rgbBuf[0], &grayMapped[0], &rgbMapped[0]);
+		benchmarkSink += rgbMapped[3 * numPoints / 2];
+	}
+	double legacySec = TicksToUs(NowTicks() - startTicks) / 1000000.0;
+
+	int fusedFrames = 0;
+	startTicks = NowTicks();
+	for(; TicksToUs(NowTicks() - startTicks) < runUs; ++fusedFrames)
+	{
+		YUY2SampleMapped(source.Color(fusedFrames), CW, CH, &points[fusedFrames % COLOR_BENCH_POINT_SETS][0]
+			, numPoints, &fusedGray[0], &fusedRgb[0]);
+		benchmarkSink += fusedRgb[3 * numPoints / 2];
+	}
+	double fusedSec = TicksToUs(NowTicks() - startTicks) / 1000000.0;
+
+	PrintColorResult("Full frame, then sampled", legacyFrames, legacySec, grayBuf.size() + rgbBuf.size() + numPoints * 4);
+	PrintColorResult("Fused sampling", fusedFrames, fusedSec, numPoints * 4);
+	cout << "Speedup: " << (legacySec / legacyFrames) / (fusedSec / fusedFrames) << "x" << endl;
+
+	if(mismatches > 0)
+		cout << mismatches << " of " << SYNTHETIC_DEFAULT_DISTINCT_FRAMES << " frames differ!" << endl;
+	return mismatches == 0;
+}
@@ -0,0 +1,55 @@
+/*
+Benchmarks and self tests that run on synthetic frames (see synthetic.h),
+so they work without a Kinect attached. Each one is started from its own
+command line switch and prints its results to cout.
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+#include <string>
+
+// Time helpers shared by the benchmarks
+INT64 NowTicks();
+double TicksToUs(INT64 ticks);
+
+// p in [0, 100]. Sorts values
+double Percentile(std::vector<double> &values, double p);
+
+// Sleeps until frame frameIdx of a fps stream started at startTicks is due
+void PaceFrame(INT64 startTicks, int frameIdx, double fps);
+
+// Publishes synthetic depth, infra and color at 30 FPS through live frame rings
+// (see framering.h) with readersPerStream readers on each, and reports
+// publish cost, publish-to-reader latency and dropped frames. Returns false if
+// any stream is over budget (LIVE_MAX_* in benchmarks.cpp)
+bool RunLiveLatencyBenchmark(int seconds, int readersPerStream);
+
+// Emulates depth, infra and color sensors signalling frames at 30 FPS and captures them
+// for seconds with one thread per stream, then with one reactor thread and a processing
+// thread (like -r). Reports wakeups, arrival-to-copy and arrival-to-processed latency and
+// dropped frames of each model.
+void RunReactorBenchmark(int seconds);
+
+// Writes seconds worth of synthetic dump files (depth, infra, grayMapped and rgbMapped
+// tiffs at 30 FPS) to path three ways, bypassing the OS write cache: one writer thread
+// per stream like the old dump, the same writers through an IoScheduler with SaveImage()
+// as the dump does (see iosched.h), and one big sequential file as the disk's best case.
+// The writers encode the tiffs as they go, so encoding is in the timings. Reports MB/s and files/s of each
+// and deletes the files. Returns false if path can't be written
+bool RunIoBenchmark(int seconds, const std::string &path);
+
+// Writes seconds of synthetic yuyv*.yuv frames and color_times.txt to path, then reads
+// rgb through a DumpReader (see dumpreader.h): scrubbing forwards at 30 FPS, back over
+// what is cached, and jumping around with an empty cache. Reports Get() latency and
+// cache / prefetch hits of each and deletes the files. Returns false if path can't be written
+bool RunReaderBenchmark(int seconds, const std::string &path);
+
+// Makes grayMapped and rgbMapped from synthetic color frames and mapped coordinates (some out
+// of frame) for seconds each two ways: the old dump path converting the whole 1080p frame to
+// gray and BGR and sampling those, and YUY2SampleMapped() (see colorconv.h). Reports ms per
+// frame and workspace bytes of each. Returns false if their outputs differ
+bool RunColorBenchmark(int seconds);
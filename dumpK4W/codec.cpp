@@ -0,0 +1,274 @@
+/*
+Lossless frame codec. See codec.h
+See main.cpp for license information.
+*/
+
+#include "codec.h"
+
+#include <algorithm>
+#include <intrin.h>	// _BitScanReverse
+
+// Distance back to the previous sample of the same channel
+struct PlanarLayout
+{
+	static int LeftStep(int /*x*/) { return 1; }
+};
+
+// Y0 U Y1 V
+struct YUY2Layout
+{
+	static int LeftStep(int x) { return (x & 1) ? 4 : 2; }
+};
+
+// Unsigned sample type to residual helpers
+template<class T> struct SampleTraits;
+
+template<> struct SampleTraits<UINT16>
+{
+	typedef INT16 Signed;
+	static UINT16 ZigZag(UINT16 r) { INT16 s = (INT16)r; return (UINT16)((s << 1) ^ (s >> 15)); }
+	static UINT16 UnZigZag(UINT16 z) { return (UINT16)((z >> 1) ^ (UINT16)(-(INT16)(z & 1))); }
+};
+
+template<> struct SampleTraits<BYTE>
+{
+	typedef signed char Signed;
+	static UINT16 ZigZag(BYTE r) { signed char s = (signed char)r; return (BYTE)((s << 1) ^ (s >> 7)); }
+	static BYTE UnZigZag(UINT16 z) { return (BYTE)((z >> 1) ^ (BYTE)(-(signed char)(z & 1))); }
+};
+
+// LOCO-I median edge detector. Same as clamping the planar prediction a + b - c
+// to [min(a, b), max(a, b)], which compiles without branches
+static inline int PredictMED(int a, int b, int c)
+{
+	int mn = std::min(a, b);
+	int mx = std::max(a, b);
+	return std::min(std::max(a + b - c, mn), mx);
+}
+
+// Prediction for sample x of row, rowAbove is NULL on the first row
+template<class T, class Layout>
+static inline int Predict(const T *row, const T *rowAbove, int x)
+{
+	int step = Layout::LeftStep(x);
+	if(!rowAbove)
+		return x >= step ? row[x - step] : 0;
+	if(x < step)
+		return rowAbove[x];
+	return PredictMED(row[x - step], rowAbove[x], rowAbove[x - step]);
+}
+
+static inline int BitLength(UINT32 v)
+{
+	unsigned long idx;
+	return _BitScanReverse(&idx, v) ? (int)idx + 1 : 0;
+}
+
+class BitWriter
+{
+public:
+	explicit BitWriter(BYTE *dst) : out(dst), start(dst), acc(0), bits(0) {}
+
+	void PutByte(BYTE b)
+	{
+		Flush();
+		*out++ = b;
+	}
+
+	void Put(UINT32 value, int numBits)
+	{
+		acc |= (UINT64)value << bits;
+		bits += numBits;
+		if(bits >= 32) {
+			*reinterpret_cast<UINT32*>(out) = (UINT32)acc;
+			out += 4;
+			acc >>= 32;
+			bits -= 32;
+		}
+	}
+
+	// Byte aligns, so block headers are always on a byte boundary
+	void Flush()
+	{
+		while(bits > 0) {
+			*out++ = (BYTE)acc;
+			acc >>= 8;
+			bits -= 8;
+		}
+		acc = 0;
+		bits = 0;
+	}
+
+	size_t Size() const { return out - start; }
+
+private:
+	BYTE *out;
+	BYTE *start;
+	UINT64 acc;
+	int bits;
+};
+
+class BitReader
+{
+public:
+	explicit BitReader(const BYTE *src) : in(src), acc(0), bits(0) {}
+
+	BYTE GetByte()
+	{
+		return *in++;
+	}
+
+	UINT32 Get(int numBits)
+	{
+		while(bits < numBits) {
+			acc |= (UINT64)(*in++) << bits;
+			bits += 8;
+		}
+		UINT32 v = (UINT32)(acc & ((1u << numBits) - 1));
+		acc >>= numBits;
+		bits -= numBits;
+		return v;
+	}
+
+	void Align()
+	{
+		acc = 0;
+		bits = 0;
+	}
+
+private:
+	const BYTE *in;
+	UINT64 acc;
+	int bits;
+};
+
+static inline void WriteBlock(BitWriter &w, const UINT16 *res, int n)
+{
+	UINT32 all = 0;
+	for(int k = 0; k < n; ++k)
+		all |= res[k];
+	int width = BitLength(all);
+
+	w.PutByte((BYTE)width);
+	if(width == 0)
+		return;
+	for(int k = 0; k < n; ++k)
+		w.Put(res[k], width);
+	w.Flush();
+}
+
+template<class T, class Layout>
+static size_t Encode(const T *src, int rowSamples, int rows, BYTE *dst)
+{
+	typedef SampleTraits<T> Traits;
+
+	BitWriter w(dst);
+	UINT16 block[CODEC_BLOCK_SAMPLES];
+	int n = 0;
+
+	for(int y = 0; y < rows; ++y)
+	{
+		const T *row = src + (size_t)y * rowSamples;
+		const T *rowAbove = y > 0 ? row - rowSamples : NULL;
+		int x = 0;
+
+		// Start of the row and the first row have no full neighbourhood
+		int edge = rowAbove ? std::min(4, rowSamples) : rowSamples;
+		for(; x < edge; ++x)
+		{
+			block[n++] = Traits::ZigZag((T)(row[x] - Predict<T, Layout>(row, rowAbove, x)));
+			if(n == CODEC_BLOCK_SAMPLES) {
+				WriteBlock(w, block, n);
+				n = 0;
+			}
+		}
+		for(; x < rowSamples; ++x)
+		{
+			int step = Layout::LeftStep(x);
+			int pred = PredictMED(row[x - step], rowAbove[x], rowAbove[x - step]);
+			block[n++] = Traits::ZigZag((T)(row[x] - pred));
+			if(n == CODEC_BLOCK_SAMPLES) {
+				WriteBlock(w, block, n);
+				n = 0;
+			}
+		}
+	}
+	if(n > 0)
+		WriteBlock(w, block, n);
+
+	w.Flush();
+	return w.Size();
+}
+
+template<class T, class Layout>
+static void Decode(const BYTE *src, int rowSamples, int rows, T *dst)
+{
+	typedef SampleTraits<T> Traits;
+
+	BitReader r(src);
+	int width = 0;
+	int left = 0;	// Samples left in the current block
+
+	for(int y = 0; y < rows; ++y)
+	{
+		T *row = dst + (size_t)y * rowSamples;
+		const T *rowAbove = y > 0 ? row - rowSamples : NULL;
+		int edge = rowAbove ? std::min(4, rowSamples) : rowSamples;
+		for(int x = 0; x < rowSamples; ++x)
+		{
+			if(left == 0) {
+				r.Align();
+				width = r.GetByte();
+				left = CODEC_BLOCK_SAMPLES;
+			}
+			UINT16 z = width ? (UINT16)r.Get(width) : 0;
+			--left;
+
+			int pred;
+			if(x < edge)
+				pred = Predict<T, Layout>(row, rowAbove, x);
+			else {
+				int step = Layout::LeftStep(x);
+				pred = PredictMED(row[x - step], rowAbove[x], rowAbove[x - step]);
+			}
+			row[x] = (T)(pred + Traits::UnZigZag(z));
+		}
+	}
+}
+
+size_t CodecMaxBytes(int numSamples)
+{
+	int numBlocks = (numSamples + CODEC_BLOCK_SAMPLES - 1) / CODEC_BLOCK_SAMPLES;
+	// Header byte + 16 bits per sample + slack for the 32 bit stores of BitWriter
+	return (size_t)numBlocks * (1 + CODEC_BLOCK_SAMPLES * 2) + 8;
+}
+
+size_t Compress16(const UINT16 *src, int width, int height, BYTE *dst)
+{
+	return Encode<UINT16, PlanarLayout>(src, width, height, dst);
+}
+
+void Decompress16(const BYTE *src, int width, int height, UINT16 *dst)
+{
+	Decode<UINT16, PlanarLayout>(src, width, height, dst);
+}
+
+size_t Compress8(const BYTE *src, int width, int height, BYTE *dst)
+{
+	return Encode<BYTE, PlanarLayout>(src, width, height, dst);
+}
+
+void Decompress8(const BYTE *src, int width, int height, BYTE *dst)
+{
+	Decode<BYTE, PlanarLayout>(src, width, height, dst);
+}
+
+size_t CompressYUY2(const BYTE *src, int width, int height, BYTE *dst)
+{
+	return Encode<BYTE, YUY2Layout>(src, width * 2, height, dst);
+}
+
+void DecompressYUY2(const BYTE *src, int width, int height, BYTE *dst)
+{
+	Decode<BYTE, YUY2Layout>(src, width * 2, height, dst);
+}
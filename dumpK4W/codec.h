@@ -0,0 +1,38 @@
+/*
+Fast lossless frame codec for keeping captured frames compressed in RAM.
+
+Each sample is predicted from its left, upper and upper-left neighbours with
+the LOCO-I / JPEG-LS median edge detector. The prediction residuals are
+zigzag coded and bit packed in blocks of CODEC_BLOCK_SAMPLES, each block
+using just enough bits for its largest residual. Flat areas and invalid
+(zero) depth compress to one byte per block; smooth depth to a few bits
+per pixel.
+
+Residuals wrap around (mod 2^16 or 2^8), so every input round trips exactly.
+
+For YUY2 each channel is predicted from the previous sample of the same
+channel (Y two bytes back, U and V four bytes back).
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+static const int CODEC_BLOCK_SAMPLES = 16;
+
+// Worst case compressed size of numSamples 16 bit samples. Buffers passed to Compress*() need this much room
+size_t CodecMaxBytes(int numSamples);
+
+// width x height UINT16 image (depth, IR)
+size_t Compress16(const UINT16 *src, int width, int height, BYTE *dst);
+void Decompress16(const BYTE *src, int width, int height, UINT16 *dst);
+
+// width x height BYTE image (body index)
+size_t Compress8(const BYTE *src, int width, int height, BYTE *dst);
+void Decompress8(const BYTE *src, int width, int height, BYTE *dst);
+
+// width x height YUY2 image, 2 bytes per pixel
+size_t CompressYUY2(const BYTE *src, int width, int height, BYTE *dst);
+void DecompressYUY2(const BYTE *src, int width, int height, BYTE *dst);
@@ -0,0 +1,98 @@
+/*
+YUY2 to gray and BGR conversion. See colorconv.h
+See main.cpp for license information.
+*/
+
+#include "colorconv.h"
+
+#include <emmintrin.h>	// SSE2
+
+static inline BYTE Clamp255(int v)
+{
+	return (BYTE)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+// BT.601 of one pixel
+static inline void YUVToBGR(int y, int u, int v, BYTE *bgr)
+{
+	int c = y - 16;
+	int d = u - 128;
+	int e = v - 128;
+	bgr[0] = Clamp255(( 298 * c + 516 * d + 128) >> 8); // blue
+	bgr[1] = Clamp255(( 298 * c - 100 * d - 208 * e + 128) >> 8); // green
+	bgr[2] = Clamp255(( 298 * c + 409 * e + 128) >> 8); // red
+}
+
+void YUY2ToGray(const BYTE *yuy2, int numPixels, BYTE *gray)
+{
+	for(int x = 0; x < numPixels; ++x)
+		gray[x] = yuy2[2*x];
+}
+
+void YUY2ToBGR(const BYTE *yuy2, int numPixels, BYTE *bgr)
+{
+	const BYTE *ptrIn = yuy2;
+	BYTE *ptrOut = bgr;
+	for(int j = 0; j < numPixels/2; ++j)
+	{
+		YUVToBGR(ptrIn[0], ptrIn[1], ptrIn[3], ptrOut);
+		YUVToBGR(ptrIn[2], ptrIn[1], ptrIn[3], ptrOut + 3);
+		ptrIn += 4;
+		ptrOut += 6;
+	}
+}
+
+// One sampled point. x, y already rounded
+static inline void SampleYUY2(const BYTE *yuy2, int width, int height, int x, int y, BYTE *gray, BYTE *bgr)
+{
+	if((unsigned)x >= (unsigned)width || (unsigned)y >= (unsigned)height) {
+		if(gray)
+			*gray = 0;
+		bgr[0] = bgr[1] = bgr[2] = 0;
+		return;
+	}
+	// Y0 U Y1 V: the pixel's own Y, U and V shared with its pair
+	const BYTE *pair = yuy2 + (((size_t)y * width + x) >> 1) * 4;
+	int luma = pair[(x & 1) * 2];
+	if(gray)
+		*gray = (BYTE)luma;
+	YUVToBGR(luma, pair[1], pair[3], bgr);
+}
+
+// The old loops rounded with (int)(double(v) + 0.5), so this adds in double too to give the same pixels.
+// cvttpd truncates towards 0 like the cast and gives INT_MIN for -inf / NaN (out of frame)
+static inline void RoundPoints(const float *colorPoints, int *x, int *y)
+{
+	const __m128d half = _mm_set1_pd(0.5);
+	__m128 a = _mm_loadu_ps(colorPoints);		// X0 Y0 X1 Y1
+	__m128 b = _mm_loadu_ps(colorPoints + 4);	// X2 Y2 X3 Y3
+	__m128i ra = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_add_pd(_mm_cvtps_pd(a), half))
+		, _mm_cvttpd_epi32(_mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(a, a)), half)));	// x0 y0 x1 y1
+	__m128i rb = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_add_pd(_mm_cvtps_pd(b), half))
+		, _mm_cvttpd_epi32(_mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(b, b)), half)));	// x2 y2 x3 y3
+	__m128i xs = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(ra), _mm_castsi128_ps(rb), _MM_SHUFFLE(2, 0, 2, 0)));
+	__m128i ys = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(ra), _mm_castsi128_ps(rb), _MM_SHUFFLE(3, 1, 3, 1)));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(x), xs);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(y), ys);
+}
+
+void YUY2SampleMapped(const BYTE *yuy2, int width, int height, const float *colorPoints, int numPoints
+	, BYTE *gray, BYTE *bgr)
+{
+	int j = 0;
+	for(; j + 4 <= numPoints; j += 4)
+	{
+		int x[4], y[4];
+		RoundPoints(colorPoints + 2*j, x, y);
+		for(int k = 0; k < 4; ++k)
+			SampleYUY2(yuy2, width, height, x[k], y[k], gray ? gray + j + k : NULL, bgr + 3*(j + k));
+	}
+
+	// Leftovers
+	for(; j < numPoints; ++j)
+	{
+		int x = static_cast<int>((double)colorPoints[2*j] + 0.5);
+		int y = static_cast<int>((double)colorPoints[2*j + 1] + 0.5);
+		SampleYUY2(yuy2, width, height, x, y, gray ? gray + j : NULL, bgr + 3*j);
+	}
+}
@@ -0,0 +1,33 @@
+/*
+YUY2 (the Kinect v2 color format) to gray and BGR conversion, shared by the
+dump (ColorEncoder in main.cpp) and the dump reader (dumpreader.h).
+
+YUY2SampleMapped() makes grayMapped and rgbMapped straight from YUY2 in one
+pass over the mapped coordinates, converting only the pixels sampled instead
+of the whole 1080p frame. Coordinates are rounded 4 at a time with SSE2 and
+pixels are gathered with scalar loads (SSE2 has no gather; AVX2 is not
+assumed).
+
+YUY2 stores 2 pixels in 4 bytes: Y0 U Y1 V. Gray is the Y channel. BGR uses
+the integer BT.601 conversion from:
+http://stackoverflow.com/questions/4491649/how-to-convert-yuy2-to-a-bitmap-in-c
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+// numPixels is even. gray gets numPixels bytes
+void YUY2ToGray(const BYTE *yuy2, int numPixels, BYTE *gray);
+
+// numPixels is even. bgr gets numPixels * 3 bytes
+void YUY2ToBGR(const BYTE *yuy2, int numPixels, BYTE *bgr);
+
+// Samples the width x height YUY2 frame at colorPoints (X, Y per point, ColorSpacePoint layout),
+// rounded like (int)(v + 0.5). Points outside the frame give 0. Same results as converting the
+// whole frame with YUY2ToGray() / YUY2ToBGR() and sampling those.
+// gray gets numPoints bytes and may be NULL, bgr gets numPoints * 3 bytes
+void YUY2SampleMapped(const BYTE *yuy2, int width, int height, const float *colorPoints, int numPoints
+	, BYTE *gray, BYTE *bgr);
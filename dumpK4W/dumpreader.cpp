@@ -0,0 +1,357 @@
+/*
+Dump directory reader. See dumpreader.h
+See main.cpp for license information.
+*/
+
+#include "dumpreader.h"
+#include "colorconv.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <opencv2/highgui/highgui.hpp>
+
+static const char* DUMP_PREFIXES[DUMP_NUM_KINDS] = { "depth", "infra", "gray", "rgb", "rgbMapped" };
+
+// <dumpPath><prefix>XXXXXXXX<extension>, like the dump writes them
+static std::string DumpFilename(const std::string &dumpPath, const char *prefix, int i, const char *extension)
+{
+	std::stringstream filename;
+	filename << dumpPath << prefix;
+	filename.width(8);
+	filename.fill('0');
+	filename << i;
+	filename << extension;
+	return filename.str();
+}
+
+static bool FileExists(const std::string &filename)
+{
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	return file.good();
+}
+
+// RelativeTime column of a <prefix>_times.txt
+static void ReadTimes(const std::string &filename, std::vector<TIMESPAN> &times)
+{
+	times.clear();
+	std::ifstream in(filename.c_str());
+	std::string header;
+	if(!std::getline(in, header))
+		return;
+	int idx;
+	TIMESPAN time;
+	while(in >> idx >> time)
+		times.push_back(time);
+}
+
+// Decoded size of one frame, for keeping prefetch within the cache
+static size_t FrameBytes(DumpFrameKind kind)
+{
+	switch(kind)
+	{
+	case DUMP_DEPTH:
+	case DUMP_INFRA: return 512 * 424 * 2;
+	case DUMP_GRAY: return DUMP_COLOR_WIDTH * DUMP_COLOR_HEIGHT;
+	case DUMP_RGB: return DUMP_COLOR_WIDTH * DUMP_COLOR_HEIGHT * 3;
+	case DUMP_RGB_MAPPED: return 512 * 424 * 3;
+	default: return 1;
+	}
+}
+
+DumpReader::DumpReader()
+	: cacheBytes(DUMP_READER_DEFAULT_CACHE_BYTES), cachedBytes(0)
+	, lastKind(-1), lastIdx(-1), prefetchKind(0), prefetchNext(0), prefetchLeft(0), prefetchStep(1)
+	, stopping(false), hits(0), prefetchHits(0), misses(0)
+{
+	for(int k = 0; k < DUMP_NUM_KINDS; ++k)
+		sources[k] = SOURCE_NONE;
+}
+
+DumpReader::~DumpReader()
+{
+	Close();
+}
+
+bool DumpReader::Open(const std::string &path, size_t maxCacheBytes)
+{
+	Close();
+	dumpPath = path;
+	cacheBytes = maxCacheBytes;
+
+	ReadTimes(dumpPath + "depth_times.txt", times[DUMP_DEPTH]);
+	ReadTimes(dumpPath + "infra_times.txt", times[DUMP_INFRA]);
+	ReadTimes(dumpPath + "color_times.txt", times[DUMP_GRAY]);
+	times[DUMP_RGB] = times[DUMP_GRAY];
+	times[DUMP_RGB_MAPPED] = times[DUMP_GRAY];
+
+	// Expanded tiffs if they were dumped, else converted from raw YUY2
+	bool isYUY2 = FileExists(DumpFilename(dumpPath, "yuyv", 0, ".yuv"));
+	bool isAny = false;
+	for(int k = 0; k < DUMP_NUM_KINDS; ++k)
+	{
+		if(FileExists(DumpFilename(dumpPath, DUMP_PREFIXES[k], 0, ".tiff")))
+			sources[k] = SOURCE_TIFF;
+		else if(isYUY2 && (k == DUMP_GRAY || k == DUMP_RGB))
+			sources[k] = SOURCE_YUY2;
+		else
+			times[k].clear();
+		isAny = isAny || !times[k].empty();
+	}
+	if(!isAny) {
+		Close();
+		return false;
+	}
+
+	stopping = false;
+	prefetcher = std::thread(&DumpReader::PrefetchThread, this);
+	return true;
+}
+
+void DumpReader::Close()
+{
+	if(prefetcher.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		hasPrefetch.notify_one();
+		prefetcher.join();
+	}
+
+	ClearCache();
+	for(int k = 0; k < DUMP_NUM_KINDS; ++k)
+	{
+		sources[k] = SOURCE_NONE;
+		times[k].clear();
+	}
+	lastKind = lastIdx = -1;
+	prefetchLeft = 0;
+	hits = prefetchHits = misses = 0;
+}
+
+bool DumpReader::IsAvailable(DumpFrameKind kind) const
+{
+	return kind >= 0 && kind < DUMP_NUM_KINDS && sources[kind] != SOURCE_NONE;
+}
+
+int DumpReader::NumFrames(DumpFrameKind kind) const
+{
+	return IsAvailable(kind) ? (int)times[kind].size() : 0;
+}
+
+TIMESPAN DumpReader::FrameTime(DumpFrameKind kind, int i) const
+{
+	return i >= 0 && i < NumFrames(kind) ? times[kind][i] : 0;
+}
+
+int DumpReader::FindFrame(DumpFrameKind kind, TIMESPAN time) const
+{
+	int numFrames = NumFrames(kind);
+	if(numFrames <= 0)
+		return -1;
+
+	const std::vector<TIMESPAN> &t = times[kind];
+	int i = (int)(std::lower_bound(t.begin(), t.end(), time) - t.begin());
+	if(i >= numFrames)
+		return numFrames - 1;
+	if(i > 0 && time - t[i - 1] < t[i] - time)
+		return i - 1;
+	return i;
+}
+
+cv::Mat DumpReader::Get(DumpFrameKind kind, int i)
+{
+	if(i < 0 || i >= NumFrames(kind))
+		return cv::Mat();
+
+	const UINT64 key = Key(kind, i);
+	cv::Mat frame;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		NoteAccess(kind, i);
+		// Already being decoded (prefetch): wait for it rather than decoding twice
+		while(pending.count(key))
+			loaded.wait(lock);
+
+		bool wasPrefetched;
+		if(Lookup(key, &frame, &wasPrefetched)) {
+			++hits;
+			if(wasPrefetched)
+				++prefetchHits;
+			return frame;
+		}
+		++misses;
+		pending.insert(key);
+	}
+
+	frame = Load(kind, i);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Insert(key, frame, false);
+		pending.erase(key);
+	}
+	loaded.notify_all();
+	return frame;
+}
+
+cv::Mat DumpReader::GetAt(DumpFrameKind kind, TIMESPAN time)
+{
+	return Get(kind, FindFrame(kind, time));
+}
+
+void DumpReader::ClearCache()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	lru.clear();
+	index.clear();
+	cachedBytes = 0;
+}
+
+int DumpReader::Hits() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return hits;
+}
+
+int DumpReader::PrefetchHits() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return prefetchHits;
+}
+
+int DumpReader::Misses() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return misses;
+}
+
+size_t DumpReader::CachedBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return cachedBytes;
+}
+
+// Reads and converts one frame. No locks held
+cv::Mat DumpReader::Load(DumpFrameKind kind, int i) const
+{
+	if(sources[kind] == SOURCE_TIFF)
+		return cv::imread(DumpFilename(dumpPath, DUMP_PREFIXES[kind], i, ".tiff"), cv::IMREAD_UNCHANGED);
+
+	std::vector<BYTE> yuy2(DUMP_COLOR_WIDTH * DUMP_COLOR_HEIGHT * 2);
+	FILE *file = fopen(DumpFilename(dumpPath, "yuyv", i, ".yuv").c_str(), "rb");
+	if(!file)
+		return cv::Mat();
+	size_t bytesRead = fread(&yuy2[0], 1, yuy2.size(), file);
+	fclose(file);
+	if(bytesRead != yuy2.size())
+		return cv::Mat();
+
+	if(kind == DUMP_GRAY) {
+		cv::Mat gray(DUMP_COLOR_HEIGHT, DUMP_COLOR_WIDTH, CV_8UC1);
+		YUY2ToGray(&yuy2[0], DUMP_COLOR_WIDTH * DUMP_COLOR_HEIGHT, gray.ptr<BYTE>());
+		return gray;
+	}
+	cv::Mat bgr(DUMP_COLOR_HEIGHT, DUMP_COLOR_WIDTH, CV_8UC3);
+	YUY2ToBGR(&yuy2[0], DUMP_COLOR_WIDTH * DUMP_COLOR_HEIGHT, bgr.ptr<BYTE>());
+	return bgr;
+}
+
+// Cache hit moves the frame to the front. Needs mutex
+bool DumpReader::Lookup(UINT64 key, cv::Mat *frame, bool *wasPrefetched)
+{
+	std::map<UINT64, EntryList::iterator>::iterator it = index.find(key);
+	if(it == index.end())
+		return false;
+	lru.splice(lru.begin(), lru, it->second);
+	Entry &entry = *it->second;
+	*frame = entry.frame;
+	*wasPrefetched = entry.isPrefetched;
+	entry.isPrefetched = false;
+	return true;
+}
+
+// Adds a frame at the front and drops least recently used frames over the budget. Needs mutex
+void DumpReader::Insert(UINT64 key, const cv::Mat &frame, bool isPrefetched)
+{
+	if(frame.empty() || index.count(key))
+		return;
+
+	Entry entry;
+	entry.key = key;
+	entry.frame = frame;
+	entry.bytes = frame.total() * frame.elemSize();
+	entry.isPrefetched = isPrefetched;
+
+	while(!lru.empty() && cachedBytes + entry.bytes > cacheBytes)
+	{
+		cachedBytes -= lru.back().bytes;
+		index.erase(lru.back().key);
+		lru.pop_back();
+	}
+	lru.push_front(entry);
+	index[key] = lru.begin();
+	cachedBytes += entry.bytes;
+}
+
+// Frames read one after another start a prefetch in that direction, anything else stops it. Needs mutex
+void DumpReader::NoteAccess(DumpFrameKind kind, int i)
+{
+	int step = 0;
+	if(kind == lastKind && i == lastIdx + 1)
+		step = 1;
+	else if(kind == lastKind && i == lastIdx - 1)
+		step = -1;
+	lastKind = kind;
+	lastIdx = i;
+
+	if(step == 0) {
+		prefetchLeft = 0;
+		return;
+	}
+
+	// At most half the cache, so prefetching can't evict what is being looked at
+	int fits = (int)(cacheBytes / 2 / FrameBytes(kind));
+	prefetchKind = kind;
+	prefetchStep = step;
+	prefetchNext = i + step;
+	prefetchLeft = std::min(DUMP_READER_PREFETCH_FRAMES, fits);
+	hasPrefetch.notify_one();
+}
+
+void DumpReader::PrefetchThread()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for(;;)
+	{
+		while(!stopping && prefetchLeft <= 0)
+			hasPrefetch.wait(lock);
+		if(stopping)
+			return;
+
+		DumpFrameKind kind = (DumpFrameKind)prefetchKind;
+		int i = prefetchNext;
+		prefetchNext += prefetchStep;
+		--prefetchLeft;
+		if(i < 0 || i >= NumFrames(kind)) {
+			prefetchLeft = 0;
+			continue;
+		}
+
+		UINT64 key = Key(kind, i);
+		if(index.count(key) || pending.count(key))
+			continue;
+		pending.insert(key);
+
+		lock.unlock();
+		cv::Mat frame = Load(kind, i);
+		lock.lock();
+
+		Insert(key, frame, true);
+		pending.erase(key);
+		loaded.notify_all();
+	}
+}
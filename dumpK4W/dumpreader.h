@@ -0,0 +1,140 @@
+/*
+Reader for dump directories, for analysis tools that scrub through a session.
+
+Frames are looked up by index or by RelativeTime (from the <prefix>_times.txt
+files) and only decoded when asked for. gray and rgb come from the raw
+yuyv*.yuv files when the expanded gray*.tiff / rgb*.tiff were not dumped
+(-y without -u), so a session only needs the compact format on disk.
+
+Decoded frames are kept in an LRU cache bounded in bytes. Frames are handed
+out as cv::Mat, which share the cached data (read only!) and stay valid after
+the cache drops them. Reading frames one after another (forwards or
+backwards) makes a background thread decode the next DUMP_READER_PREFETCH_FRAMES
+in that direction, so scrubbing mostly hits the cache.
+
+All methods are thread safe. To use from another program, compile
+dumpreader.cpp and colorconv.cpp into it.
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <opencv2/core/core.hpp>
+
+typedef INT64 TIMESPAN;	// As in Kinect.h
+
+enum DumpFrameKind
+{
+	DUMP_DEPTH,			// CV_16UC1 512x424
+	DUMP_INFRA,			// CV_16UC1 512x424
+	DUMP_GRAY,			// CV_8UC1 1920x1080
+	DUMP_RGB,			// CV_8UC3 (BGR) 1920x1080
+	DUMP_RGB_MAPPED,	// CV_8UC3 (BGR) 512x424
+	DUMP_NUM_KINDS
+};
+
+static const int DUMP_COLOR_WIDTH = 1920;
+static const int DUMP_COLOR_HEIGHT = 1080;
+static const size_t DUMP_READER_DEFAULT_CACHE_BYTES = 512 * 1024 * 1024;
+static const int DUMP_READER_PREFETCH_FRAMES = 8;
+
+class DumpReader
+{
+public:
+	DumpReader();
+	~DumpReader();
+
+	// dumpPath is the session directory, e.g. "E:/dump/2015-01-01_12-00-00/"
+	// False if it holds no frames
+	bool Open(const std::string &dumpPath, size_t cacheBytes = DUMP_READER_DEFAULT_CACHE_BYTES);
+	void Close();
+
+	bool IsAvailable(DumpFrameKind kind) const;
+	int NumFrames(DumpFrameKind kind) const;
+	TIMESPAN FrameTime(DumpFrameKind kind, int i) const;
+
+	// Frame closest to time, -1 if there are none
+	int FindFrame(DumpFrameKind kind, TIMESPAN time) const;
+
+	// Empty Mat if the frame doesn't exist or can't be read
+	cv::Mat Get(DumpFrameKind kind, int i);
+	cv::Mat GetAt(DumpFrameKind kind, TIMESPAN time);
+
+	// Drops all cached frames
+	void ClearCache();
+
+	int Hits() const;				// Get() served from the cache
+	int PrefetchHits() const;		// ... with a frame the prefetch thread decoded
+	int Misses() const;				// Get() had to decode
+	size_t CachedBytes() const;
+
+private:
+	// Where a kind of frame is read from
+	enum Source
+	{
+		SOURCE_NONE,
+		SOURCE_TIFF,		// <prefix>XXXXXXXX.tiff
+		SOURCE_YUY2			// yuyvXXXXXXXX.yuv, converted
+	};
+
+	struct Entry
+	{
+		UINT64 key;
+		cv::Mat frame;
+		size_t bytes;
+		bool isPrefetched;	// Not asked for yet
+	};
+
+	typedef std::list<Entry> EntryList;
+
+	static UINT64 Key(DumpFrameKind kind, int i) { return ((UINT64)kind << 32) | (UINT32)i; }
+
+	cv::Mat Load(DumpFrameKind kind, int i) const;
+	bool Lookup(UINT64 key, cv::Mat *frame, bool *wasPrefetched);
+	void Insert(UINT64 key, const cv::Mat &frame, bool isPrefetched);
+	void NoteAccess(DumpFrameKind kind, int i);
+	void PrefetchThread();
+
+	std::string dumpPath;
+	Source sources[DUMP_NUM_KINDS];
+	std::vector<TIMESPAN> times[DUMP_NUM_KINDS];
+
+	mutable std::mutex mutex;
+	std::condition_variable loaded;			// A pending frame was inserted
+	std::condition_variable hasPrefetch;
+	EntryList lru;							// Most recently used first
+	std::map<UINT64, EntryList::iterator> index;
+	std::set<UINT64> pending;				// Being decoded
+	size_t cacheBytes;
+	size_t cachedBytes;
+
+	// Sequential access detection and the prefetch it asked for
+	int lastKind;
+	int lastIdx;
+	int prefetchKind;
+	int prefetchNext;
+	int prefetchLeft;
+	int prefetchStep;		// +1 or -1
+
+	std::thread prefetcher;
+	bool stopping;
+
+	int hits;
+	int prefetchHits;
+	int misses;
+
+	DumpReader(const DumpReader&);
+	DumpReader& operator=(const DumpReader&);
+};
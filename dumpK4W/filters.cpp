@@ -0,0 +1,171 @@
+/*
+Depth and infrared cleanup filters. See filters.h
+See main.cpp for license information.
+*/
+
+#include "filters.h"
+
+#include <emmintrin.h>	// SSE2
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// SSE2 only has signed 16 bit min/max. Flipping the sign bit maps unsigned order onto signed order.
+static const __m128i SIGN_BIT_16 = _mm_set1_epi16((short)0x8000);
+
+// |a - b| for unsigned 16 bit lanes
+static inline __m128i AbsDiffU16(__m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+}
+
+// All ones in lanes where a > b (unsigned 16 bit)
+static inline __m128i GreaterThanU16(__m128i a, __m128i b)
+{
+	__m128i zero = _mm_setzero_si128();
+	return _mm_xor_si128(_mm_cmpeq_epi16(_mm_subs_epu16(a, b), zero), _mm_set1_epi16(-1));
+}
+
+// Odd-even transposition sort of N sign flipped vectors, returns the middle one
+template<int N>
+static inline __m128i MedianN(__m128i *v)
+{
+	for(int pass = 0; pass < N; ++pass)
+	{
+		for(int j = pass & 1; j + 1 < N; j += 2)
+		{
+			__m128i lo = _mm_min_epi16(v[j], v[j+1]);
+			__m128i hi = _mm_max_epi16(v[j], v[j+1]);
+			v[j] = lo;
+			v[j+1] = hi;
+		}
+	}
+	return v[N/2];
+}
+
+template<int N>
+static void TemporalMedianN(const UINT16* const* frames, int numPixels, UINT16* out)
+{
+	int p = 0;
+	for(; p + 8 <= numPixels; p += 8)
+	{
+		__m128i v[N];
+		for(int f = 0; f < N; ++f)
+			v[f] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(frames[f] + p)), SIGN_BIT_16);
+
+		__m128i m = _mm_xor_si128(MedianN<N>(v), SIGN_BIT_16);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + p), m);
+	}
+
+	// Leftovers
+	for(; p < numPixels; ++p)
+	{
+		UINT16 v[N];
+		for(int f = 0; f < N; ++f)
+			v[f] = frames[f][p];
+		std::nth_element(v, v + N/2, v + N);
+		out[p] = v[N/2];
+	}
+}
+
+void TemporalMedian(const UINT16* const* frames, int numFrames, int numPixels, UINT16* out)
+{
+	switch(numFrames)
+	{
+	case 1: memcpy(out, frames[0], sizeof(UINT16)*numPixels); break;
+	case 3: TemporalMedianN<3>(frames, numPixels, out); break;
+	case 5: TemporalMedianN<5>(frames, numPixels, out); break;
+	case 7: TemporalMedianN<7>(frames, numPixels, out); break;
+	case 9: TemporalMedianN<9>(frames, numPixels, out); break;
+	default:
+		// Even or too large. Caller should have gone through TemporalWindow()
+		memcpy(out, frames[numFrames/2], sizeof(UINT16)*numPixels);
+		break;
+	}
+}
+
+void MaskDepthByInfra(UINT16* depth, const UINT16* infra, int numPixels, UINT16 minIR, UINT16 maxIR)
+{
+	// invalid <=> minIR > ir || ir > maxIR - 1
+	__m128i minV = _mm_set1_epi16((short)minIR);
+	__m128i maxV = _mm_set1_epi16((short)(maxIR - 1));
+
+	int p = 0;
+	for(; p + 8 <= numPixels; p += 8)
+	{
+		__m128i ir = _mm_loadu_si128(reinterpret_cast<const __m128i*>(infra + p));
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + p));
+
+		__m128i tooLow = GreaterThanU16(minV, ir);
+		__m128i tooHigh = GreaterThanU16(ir, maxV);
+
+		d = _mm_andnot_si128(_mm_or_si128(tooLow, tooHigh), d);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(depth + p), d);
+	}
+
+	for(; p < numPixels; ++p)
+	{
+		if(infra[p] < minIR || infra[p] >= maxIR)
+			depth[p] = 0;
+	}
+}
+
+void RemoveFlyingPixels(const UINT16* depthIn, UINT16* depthOut, int width, int height, UINT16 thresholdMM)
+{
+	// Border rows and columns have incomplete neighbourhoods and are copied as is
+	memcpy(depthOut, depthIn, sizeof(UINT16)*width);
+	memcpy(depthOut + (height-1)*width, depthIn + (height-1)*width, sizeof(UINT16)*width);
+
+	__m128i thresh = _mm_set1_epi16((short)thresholdMM);
+
+	for(int y = 1; y < height - 1; ++y)
+	{
+		const UINT16* row = depthIn + y*width;
+		const UINT16* up = row - width;
+		const UINT16* down = row + width;
+		UINT16* out = depthOut + y*width;
+
+		out[0] = row[0];
+		out[width-1] = row[width-1];
+
+		int x = 1;
+		for(; x + 8 <= width - 1; x += 8)
+		{
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+			__m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+			__m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+			__m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x));
+			__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x));
+
+			__m128i jumpL = GreaterThanU16(AbsDiffU16(c, l), thresh);
+			__m128i jumpR = GreaterThanU16(AbsDiffU16(c, r), thresh);
+			__m128i jumpU = GreaterThanU16(AbsDiffU16(c, u), thresh);
+			__m128i jumpD = GreaterThanU16(AbsDiffU16(c, d), thresh);
+
+			__m128i flying = _mm_or_si128(_mm_and_si128(jumpL, jumpR), _mm_and_si128(jumpU, jumpD));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_andnot_si128(flying, c));
+		}
+
+		for(; x < width - 1; ++x)
+		{
+			int c = row[x];
+			bool jumpX = abs(c - row[x-1]) > thresholdMM && abs(c - row[x+1]) > thresholdMM;
+			bool jumpY = abs(c - up[x]) > thresholdMM && abs(c - down[x]) > thresholdMM;
+			out[x] = (jumpX || jumpY) ? 0 : row[x];
+		}
+	}
+}
+
+int TemporalWindow(int frameIdx, int totalFrames, int numFrames, int* firstFrame)
+{
+	numFrames = std::min(numFrames, std::min(totalFrames, FILTER_MAX_MEDIAN_FRAMES));
+	if(numFrames % 2 == 0)
+		--numFrames;
+	if(numFrames < 1)
+		numFrames = 1;
+
+	int first = frameIdx - numFrames/2;
+	first = std::max(0, std::min(first, totalFrames - numFrames));
+	*firstFrame = first;
+	return numFrames;
+}
@@ -0,0 +1,41 @@
+/*
+Depth and infrared cleanup filters for the flashing depth / IR caused by
+reflective objects (see foo.txt). All filters work on raw 512x424 UINT16
+buffers straight from the sensor and never modify their input, so the raw
+frames can still be dumped alongside the filtered ones.
+
+Kernels are SSE2 and process 8 pixels at a time. Parallelism is over frames
+(see parallel.h), each kernel call handles one frame.
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+// Depth pixels with IR amplitude outside [min, max) are unreliable.
+// Very low amplitude => noise, saturated amplitude => reflections / multipath
+static const UINT16 FILTER_MIN_IR_AMPLITUDE = 32;
+static const UINT16 FILTER_MAX_IR_AMPLITUDE = 65535;
+
+// A depth pixel that jumps by more than this (mm) to both of its neighbours
+// along x or along y is a flying pixel (smeared between foreground and background)
+static const UINT16 FILTER_FLYING_PIXEL_MM = 100;
+
+// Temporal median window (frames). Must be odd.
+static const int FILTER_DEFAULT_MEDIAN_FRAMES = 5;
+static const int FILTER_MAX_MEDIAN_FRAMES = 9;
+
+// out[p] = median of frames[0..numFrames-1][p]. numFrames must be odd and <= FILTER_MAX_MEDIAN_FRAMES
+void TemporalMedian(const UINT16* const* frames, int numFrames, int numPixels, UINT16* out);
+
+// Zeroes (marks invalid) depth pixels whose IR amplitude is outside [minIR, maxIR)
+void MaskDepthByInfra(UINT16* depth, const UINT16* infra, int numPixels, UINT16 minIR, UINT16 maxIR);
+
+// Zeroes flying pixels. depthIn and depthOut must not overlap.
+void RemoveFlyingPixels(const UINT16* depthIn, UINT16* depthOut, int width, int height, UINT16 thresholdMM);
+
+// Picks the window of numFrames frames around frameIdx, shifted so it stays inside [0, totalFrames).
+// Returns the actual (odd) window size used, which is smaller than numFrames for short captures.
+int TemporalWindow(int frameIdx, int totalFrames, int numFrames, int* firstFrame);
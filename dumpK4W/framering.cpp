@@ -0,0 +1,384 @@
+/*
+Live frame publishing through shared memory. See framering.h
+See main.cpp for license information.
+*/
+
+#include "framering.h"
+
+#include <sstream>
+#include <iostream>
+
+static const UINT32 CACHE_LINE = 64;
+
+static UINT32 RoundUp(UINT32 x, UINT32 align)
+{
+	return (x + align - 1) / align * align;
+}
+
+static UINT32 HeaderBytes()
+{
+	return RoundUp(sizeof(FrameRingHeader), CACHE_LINE);
+}
+
+static UINT32 SlotHeaderBytes()
+{
+	return RoundUp(sizeof(FrameSlotHeader), CACHE_LINE);
+}
+
+std::wstring FrameRingEventName(const std::wstring &name, int readerIdx)
+{
+	std::wstringstream ss;
+	ss << name << L"_reader" << readerIdx;
+	return ss.str();
+}
+
+// False once the process has exited. Processes we may not query are taken as alive
+static bool IsProcessAlive(LONG pid)
+{
+	HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+	if(process == NULL)
+		return GetLastError() == ERROR_ACCESS_DENIED;
+	DWORD exitCode = 0;
+	BOOL ok = GetExitCodeProcess(process, &exitCode);
+	CloseHandle(process);
+	return !ok || exitCode == STILL_ACTIVE;
+}
+
+// ---- Writer ----
+
+FrameRingWriter::FrameRingWriter()
+	: mapping(NULL), header(NULL), lastSeq(0)
+{
+	for(int r = 0; r < LIVE_RING_MAX_READERS; ++r)
+	{
+		readerEvents[r] = NULL;
+		readerPids[r] = 0;
+	}
+}
+
+FrameRingWriter::~FrameRingWriter()
+{
+	Close();
+}
+
+bool FrameRingWriter::Create(const wchar_t *ringName, UINT32 width, UINT32 height, UINT32 bytesPerPixel, int numSlots)
+{
+	Close();
+
+	UINT32 payloadBytes = width * height * bytesPerPixel;
+	UINT32 slotStride = SlotHeaderBytes() + RoundUp(payloadBytes, CACHE_LINE);
+	UINT64 totalBytes = HeaderBytes() + (UINT64)slotStride * numSlots;
+
+	mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE
+		, (DWORD)(totalBytes >> 32), (DWORD)(totalBytes & 0xFFFFFFFF), ringName);
+	if(mapping == NULL) {
+		std::cerr << "Unable to create live ring: " << GetLastError() << std::endl;
+		return false;
+	}
+	bool exists = GetLastError() == ERROR_ALREADY_EXISTS;	// Kept alive by readers of an earlier run
+
+	header = static_cast<FrameRingHeader*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+	if(header == NULL) {
+		std::cerr << "Unable to map live ring: " << GetLastError() << std::endl;
+		CloseHandle(mapping);
+		mapping = NULL;
+		return false;
+	}
+
+	name = ringName;
+	lastSeq = 0;
+	if(exists) {
+		if(!TakeOver(width, height, bytesPerPixel, numSlots, slotStride)) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	// Fresh page file mappings are zeroed, so slots start out as "never written"
+	header->writer = (LONG)GetCurrentProcessId();
+	header->numSlots = numSlots;
+	header->slotStride = slotStride;
+	header->payloadBytes = payloadBytes;
+	header->width = width;
+	header->height = height;
+	header->bytesPerPixel = bytesPerPixel;
+	header->lastSeq = 0;
+	header->version = LIVE_RING_VERSION;
+	MemoryBarrier();
+	header->magic = LIVE_RING_MAGIC;	// Last, readers check this
+	return true;
+}
+
+// Reuses a ring left by an earlier writer. Its size was fixed by whoever created it, so the layout has
+// to match. Readers stay registered; the seqlock makes them drop frames they were in the middle of
+bool FrameRingWriter::TakeOver(UINT32 width, UINT32 height, UINT32 bytesPerPixel, UINT32 numSlots, UINT32 slotStride)
+{
+	if(header->magic != LIVE_RING_MAGIC || header->version != LIVE_RING_VERSION) {
+		std::cerr << "Live ring exists with another version. Close its readers" << std::endl;
+		return false;
+	}
+	if(header->numSlots != numSlots || header->slotStride != slotStride || header->width != width
+		|| header->height != height || header->bytesPerPixel != bytesPerPixel) {
+		std::cerr << "Live ring exists with another frame size or slot count. Close its readers" << std::endl;
+		return false;
+	}
+
+	LONG pid = (LONG)GetCurrentProcessId();
+	LONG owner = header->writer;
+	if((owner != 0 && IsProcessAlive(owner)) || InterlockedCompareExchange(&header->writer, pid, owner) != owner) {
+		std::cerr << "Live ring is in use. Is another dumpK4W running?" << std::endl;
+		return false;
+	}
+
+	// Slots first, so a reader can't pick up an old frame under a new sequence number
+	for(UINT32 s = 0; s < numSlots; ++s)
+		InterlockedExchange64(&Slot(s)->seq, 0);
+	InterlockedExchange64(&header->lastSeq, 0);
+	return true;
+}
+
+void FrameRingWriter::Close()
+{
+	for(int r = 0; r < LIVE_RING_MAX_READERS; ++r)
+	{
+		if(readerEvents[r]) {
+			CloseHandle(readerEvents[r]);
+			readerEvents[r] = NULL;
+		}
+		readerPids[r] = 0;
+	}
+	if(header) {
+		InterlockedCompareExchange(&header->writer, 0, (LONG)GetCurrentProcessId());
+		UnmapViewOfFile(header);
+		header = NULL;
+	}
+	if(mapping) {
+		CloseHandle(mapping);
+		mapping = NULL;
+	}
+}
+
+FrameSlotHeader* FrameRingWriter::Slot(INT64 seq)
+{
+	BYTE *base = reinterpret_cast<BYTE*>(header) + HeaderBytes();
+	return reinterpret_cast<FrameSlotHeader*>(base + (seq % header->numSlots) * header->slotStride);
+}
+
+void FrameRingWriter::Publish(const void *data, UINT32 bytes, TIMESPAN relativeTime)
+{
+	if(!header)
+		return;
+	if(bytes > header->payloadBytes)
+		bytes = header->payloadBytes;
+
+	INT64 seq = lastSeq + 1;
+	FrameSlotHeader *slot = Slot(seq);
+
+	// Readers still looking at the old frame in this slot will see it change
+	InterlockedExchange64(&slot->seq, -seq);
+
+	slot->relativeTime = relativeTime;
+	slot->bytes = bytes;
+	memcpy(reinterpret_cast<BYTE*>(slot) + SlotHeaderBytes(), data, bytes);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	slot->publishTicks = now.QuadPart;
+
+	InterlockedExchange64(&slot->seq, seq);
+	InterlockedExchange64(&header->lastSeq, seq);
+	lastSeq = seq;
+
+	if(seq % LIVE_RING_REAP_FRAMES == 0)
+		ReapDeadReaders();
+	WakeReaders();
+}
+
+void FrameRingWriter::WakeReaders()
+{
+	for(int r = 0; r < LIVE_RING_MAX_READERS; ++r)
+	{
+		LONG pid = header->readers[r];
+		if(pid != readerPids[r] && readerEvents[r]) {
+			// Reader left, or another one took over the slot
+			CloseHandle(readerEvents[r]);
+			readerEvents[r] = NULL;
+		}
+		readerPids[r] = pid;
+		if(pid == 0)
+			continue;
+
+		// Reader registered since the last frame
+		if(!readerEvents[r])
+			readerEvents[r] = OpenEvent(EVENT_MODIFY_STATE, FALSE, FrameRingEventName(name, r).c_str());
+		if(readerEvents[r])
+			SetEvent(readerEvents[r]);
+	}
+}
+
+// Frees the slots of readers that died without Close(), so they are neither woken up nor kept from new readers
+void FrameRingWriter::ReapDeadReaders()
+{
+	for(int r = 0; r < LIVE_RING_MAX_READERS; ++r)
+	{
+		LONG pid = header->readers[r];
+		if(pid != 0 && !IsProcessAlive(pid))
+			InterlockedCompareExchange(&header->readers[r], 0, pid);
+	}
+}
+
+// ---- Reader ----
+
+FrameRingReader::FrameRingReader()
+	: mapping(NULL), header(NULL), event(NULL), readerIdx(-1), lastReturned(0), dropped(0)
+{
+}
+
+FrameRingReader::~FrameRingReader()
+{
+	Close();
+}
+
+bool FrameRingReader::Open(const wchar_t *name)
+{
+	Close();
+
+	mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, name);
+	if(mapping == NULL)
+		return false;
+
+	header = static_cast<FrameRingHeader*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+	if(header == NULL || header->magic != LIVE_RING_MAGIC || header->version != LIVE_RING_VERSION) {
+		Close();
+		return false;
+	}
+
+	// Claiming a reader slot: a free one, or one left behind by a reader that died without Close()
+	LONG pid = (LONG)GetCurrentProcessId();
+	for(int r = 0; r < LIVE_RING_MAX_READERS && readerIdx < 0; ++r)
+	{
+		LONG owner = header->readers[r];
+		if(owner != 0 && IsProcessAlive(owner))
+			continue;
+		if(InterlockedCompareExchange(&header->readers[r], pid, owner) == owner)
+			readerIdx = r;
+	}
+	if(readerIdx < 0) {
+		Close();
+		return false;
+	}
+
+	// Auto reset, so a wakeup is never lost between checking lastSeq and waiting
+	event = CreateEvent(NULL, FALSE, FALSE, FrameRingEventName(name, readerIdx).c_str());
+	if(event == NULL) {
+		Close();
+		return false;
+	}
+
+	// Starting from whatever is newest now
+	lastReturned = header->lastSeq;
+	dropped = 0;
+	return true;
+}
+
+void FrameRingReader::Close()
+{
+	if(header && readerIdx >= 0)
+		InterlockedExchange(&header->readers[readerIdx], 0);
+	readerIdx = -1;
+
+	if(event) {
+		CloseHandle(event);
+		event = NULL;
+	}
+	if(header) {
+		UnmapViewOfFile(header);
+		header = NULL;
+	}
+	if(mapping) {
+		CloseHandle(mapping);
+		mapping = NULL;
+	}
+}
+
+const FrameSlotHeader* FrameRingReader::Slot(INT64 seq) const
+{
+	const BYTE *base = reinterpret_cast<const BYTE*>(header) + HeaderBytes();
+	return reinterpret_cast<const FrameSlotHeader*>(base + (seq % header->numSlots) * header->slotStride);
+}
+
+bool FrameRingReader::Fill(INT64 seq, FrameView *view)
+{
+	const FrameSlotHeader *slot = Slot(seq);
+	if(slot->seq != seq)
+		return false;
+	MemoryBarrier();
+
+	view->seq = seq;
+	view->relativeTime = slot->relativeTime;
+	view->publishTicks = slot->publishTicks;
+	view->bytes = slot->bytes;
+	view->data = reinterpret_cast<const BYTE*>(slot) + SlotHeaderBytes();
+	view->width = header->width;
+	view->height = header->height;
+	view->bytesPerPixel = header->bytesPerPixel;
+
+	// Header fields could have been torn by the writer starting on this slot again
+	MemoryBarrier();
+	return slot->seq == seq;
+}
+
+bool FrameRingReader::Next(FrameView *view, DWORD timeoutMs)
+{
+	if(!header)
+		return false;
+
+	for(;;)
+	{
+		INT64 latest = header->lastSeq;
+		if(latest < lastReturned)
+			lastReturned = 0;	// A new writer took the ring over
+		while(latest > lastReturned)
+		{
+			INT64 want = lastReturned + 1;
+			if(latest - want > (INT64)header->numSlots / 2) {
+				dropped += latest - want;
+				want = latest;
+			}
+
+			lastReturned = want;
+			if(Fill(want, view))
+				return true;
+			++dropped;	// Overwritten before we got to it
+		}
+
+		if(WaitForSingleObject(event, timeoutMs) != WAIT_OBJECT_0)
+			return false;
+	}
+}
+
+bool FrameRingReader::Latest(FrameView *view)
+{
+	if(!header)
+		return false;
+
+	INT64 latest = header->lastSeq;
+	if(latest <= 0 || !Fill(latest, view))
+		return false;
+
+	if(latest < lastReturned)
+		lastReturned = 0;	// A new writer took the ring over
+	if(latest > lastReturned + 1)
+		dropped += latest - lastReturned - 1;
+	lastReturned = latest;
+	return true;
+}
+
+bool FrameRingReader::IsValid(const FrameView &view) const
+{
+	if(!header)
+		return false;
+	MemoryBarrier();
+	return Slot(view.seq)->seq == view.seq;
+}
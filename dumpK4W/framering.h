@@ -0,0 +1,163 @@
+/*
+Live frame publishing to other local processes through shared memory.
+
+Each stream (depth, infra, color etc) gets its own named ring of frame slots in a
+page file backed file mapping. The capture thread publishes every frame into
+the next slot together with its sequence number and RelativeTime. Readers map
+the same memory and look at frames in place (zero-copy). The writer never
+waits for readers; a reader that falls behind loses frames, which it can see
+from the sequence numbers.
+
+Each slot has a seqlock style sequence number: negative while the writer is
+filling it, the frame sequence number once published. A reader checks the
+number again after it is done with the data (FrameRingReader::IsValid) to
+know the slot was not overwritten under it.
+
+Readers register a wakeup event in the ring header so they can block on new
+frames instead of polling. A reader that dies without Close() leaves its
+process id behind: the writer frees such slots every LIVE_RING_REAP_FRAMES
+frames and Open() takes them over, so crashed readers don't use up the ring.
+
+Readers may keep a ring's mapping alive across dumpK4W runs. The next writer
+then takes the existing ring over if it has the same layout, restarting the
+sequence numbers at 1; readers see lastSeq go backwards and start over from
+the new frames.
+
+To use from another program, compile framering.cpp into it and open the ring
+by name, e.g. FrameRingReader::Open(LIVE_RING_DEPTH_NAME)
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <string>
+
+typedef INT64 TIMESPAN;	// As in Kinect.h
+
+static const wchar_t* LIVE_RING_DEPTH_NAME = L"Local\\dumpK4W_depth";
+static const wchar_t* LIVE_RING_INFRA_NAME = L"Local\\dumpK4W_infra";
+static const wchar_t* LIVE_RING_COLOR_NAME = L"Local\\dumpK4W_color";
+static const wchar_t* LIVE_RING_BODY_INDEX_NAME = L"Local\\dumpK4W_bodyIndex";
+static const wchar_t* LIVE_RING_LONG_INFRA_NAME = L"Local\\dumpK4W_longInfra";
+
+static const UINT32 LIVE_RING_MAGIC = 0x5257344B;	// "K4WR"
+static const UINT32 LIVE_RING_VERSION = 2;
+static const int LIVE_RING_DEFAULT_SLOTS = 8;		// ~1/4 second at 30 FPS
+static const int LIVE_RING_MAX_READERS = 8;
+static const INT64 LIVE_RING_REAP_FRAMES = 30;		// How often the writer looks for dead readers
+
+// Shared memory layout: FrameRingHeader, then numSlots x (FrameSlotHeader + payload)
+// padded to slotStride. Everything is 64 byte aligned.
+struct FrameRingHeader
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT32 numSlots;
+	UINT32 slotStride;				// Bytes from one FrameSlotHeader to the next
+	UINT32 payloadBytes;			// Max frame size
+	UINT32 width;
+	UINT32 height;
+	UINT32 bytesPerPixel;
+	volatile LONG64 lastSeq;		// Newest published frame, 0 = none yet. Goes back to 0 when a new writer takes over
+	volatile LONG writer;			// Process id of the writer or 0
+	volatile LONG readers[LIVE_RING_MAX_READERS];	// Process id of registered reader or 0
+};
+
+struct FrameSlotHeader
+{
+	volatile LONG64 seq;			// < 0 while being written, frame seq (>= 1) once published
+	TIMESPAN relativeTime;			// From the sensor, 100ns ticks
+	INT64 publishTicks;				// QueryPerformanceCounter() when published. For latency measurements
+	UINT32 bytes;
+};
+
+// A published frame, pointing into the shared memory
+struct FrameView
+{
+	INT64 seq;
+	TIMESPAN relativeTime;
+	INT64 publishTicks;
+	const void *data;
+	UINT32 bytes;
+	UINT32 width;
+	UINT32 height;
+	UINT32 bytesPerPixel;
+};
+
+class FrameRingWriter
+{
+public:
+	FrameRingWriter();
+	~FrameRingWriter();
+
+	bool Create(const wchar_t *name, UINT32 width, UINT32 height, UINT32 bytesPerPixel, int numSlots);
+	void Close();
+	bool IsOpen() const { return header != NULL; }
+
+	// Copies data into the next slot and wakes up readers. Sequence numbers start at 1.
+	void Publish(const void *data, UINT32 bytes, TIMESPAN relativeTime);
+
+	INT64 LastSeq() const { return lastSeq; }
+
+private:
+	FrameSlotHeader* Slot(INT64 seq);
+	bool TakeOver(UINT32 width, UINT32 height, UINT32 bytesPerPixel, UINT32 numSlots, UINT32 slotStride);
+	void WakeReaders();
+	void ReapDeadReaders();
+
+	std::wstring name;
+	HANDLE mapping;
+	FrameRingHeader *header;
+	INT64 lastSeq;
+	HANDLE readerEvents[LIVE_RING_MAX_READERS];
+	LONG readerPids[LIVE_RING_MAX_READERS];		// Reader readerEvents[r] was opened for
+
+	// No copying. Owns handles
+	FrameRingWriter(const FrameRingWriter&);
+	FrameRingWriter& operator=(const FrameRingWriter&);
+};
+
+class FrameRingReader
+{
+public:
+	FrameRingReader();
+	~FrameRingReader();
+
+	// Fails if the writer has not created the ring yet or all reader slots are taken.
+	// The ring stays usable when the writer is restarted
+	bool Open(const wchar_t *name);
+	void Close();
+	bool IsOpen() const { return header != NULL; }
+
+	// Next frame after the last one returned, waiting up to timeoutMs for it.
+	// If the reader is more than half the ring behind it skips ahead to the newest frame.
+	bool Next(FrameView *view, DWORD timeoutMs);
+
+	// Newest frame, without waiting. False if nothing published yet.
+	bool Latest(FrameView *view);
+
+	// True if the slot behind view has not been reused since. Check after using view.data
+	bool IsValid(const FrameView &view) const;
+
+	// Frames skipped (reader too slow) or overwritten before they could be read
+	INT64 Dropped() const { return dropped; }
+
+private:
+	const FrameSlotHeader* Slot(INT64 seq) const;
+	bool Fill(INT64 seq, FrameView *view);
+
+	HANDLE mapping;
+	FrameRingHeader *header;
+	HANDLE event;
+	int readerIdx;
+	INT64 lastReturned;
+	INT64 dropped;
+
+	FrameRingReader(const FrameRingReader&);
+	FrameRingReader& operator=(const FrameRingReader&);
+};
+
+// Name of the wakeup event of reader readerIdx of ring name
+std::wstring FrameRingEventName(const std::wstring &name, int readerIdx);
@@ -0,0 +1,287 @@
+/*
+Compressed in-RAM frame store. See framestore.h
+See main.cpp for license information.
+*/
+
+#include "framestore.h"
+
+#include <algorithm>
+#include <cstring>
+
+// ---- CompressedArena ----
+
+CompressedArena::CompressedArena()
+	: cur(NULL), curLeft(0), reserved(0)
+{
+}
+
+CompressedArena::~CompressedArena()
+{
+	Clear();
+}
+
+BYTE* CompressedArena::Allocate(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(bytes > curLeft) {
+		// The tail of the old chunk is wasted, at most one frame's worth
+		size_t chunkBytes = std::max(bytes, ARENA_CHUNK_BYTES);
+		cur = new BYTE[chunkBytes];
+		curLeft = chunkBytes;
+		chunks.push_back(cur);
+		reserved += chunkBytes;
+	}
+	BYTE *p = cur;
+	cur += bytes;
+	curLeft -= bytes;
+	return p;
+}
+
+void CompressedArena::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for(size_t c = 0; c < chunks.size(); ++c)
+		delete [] chunks[c];
+	chunks.clear();
+	cur = NULL;
+	curLeft = 0;
+	reserved = 0;
+}
+
+UINT64 CompressedArena::BytesReserved() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return reserved;
+}
+
+// ---- RawSlotPool ----
+
+RawSlotPool::RawSlotPool()
+	: bytesPerSlot(0), grown(0), dropped(0)
+{
+}
+
+RawSlotPool::~RawSlotPool()
+{
+	Free();
+}
+
+void RawSlotPool::Init(size_t bytes, int numSlots)
+{
+	Free();
+	std::lock_guard<std::mutex> lock(mutex);
+	bytesPerSlot = bytes;
+	for(int s = 0; s < numSlots; ++s)
+	{
+		all.push_back(new BYTE[bytesPerSlot]);
+		available.push_back(all.back());
+	}
+}
+
+void RawSlotPool::Free()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for(size_t s = 0; s < all.size(); ++s)
+		delete [] all[s];
+	all.clear();
+	available.clear();
+	grown = 0;
+	dropped = 0;
+}
+
+void* RawSlotPool::Acquire()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(available.empty()) {
+		if((int)all.size() >= COMPRESS_MAX_RAW_SLOTS) {
+			++dropped;
+			return NULL;
+		}
+		all.push_back(new BYTE[bytesPerSlot]);
+		++grown;
+		return all.back();
+	}
+	BYTE *slot = available.back();
+	available.pop_back();
+	return slot;
+}
+
+void RawSlotPool::Release(void *slot)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	available.push_back(static_cast<BYTE*>(slot));
+}
+
+int RawSlotPool::Grown() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return grown;
+}
+
+int RawSlotPool::Dropped() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return dropped;
+}
+
+UINT64 RawSlotPool::BytesAllocated() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return (UINT64)all.size() * bytesPerSlot;
+}
+
+// ---- FrameCompressor ----
+
+FrameCompressor::FrameCompressor()
+	: scratchBytes(0), busy(0), stopping(false)
+	, rawBytes(0), compressedBytes(0), busyTicks(0), peakQueued(0)
+{
+}
+
+FrameCompressor::~FrameCompressor()
+{
+	Finish();
+}
+
+void FrameCompressor::Start(int numWorkers, size_t bytes)
+{
+	scratchBytes = bytes;
+	stopping = false;
+	for(int w = 0; w < numWorkers; ++w)
+		workers.push_back(std::thread(&FrameCompressor::Worker, this));
+}
+
+void FrameCompressor::Submit(const void *raw, UINT32 bytes, CompressFunc compress, RawSlotPool *pool, CompressedFrame *out)
+{
+	Job job;
+	job.raw = raw;
+	job.rawBytes = bytes;
+	job.compress = compress;
+	job.pool = pool;
+	job.out = out;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(job);
+		peakQueued = std::max(peakQueued, (int)queue.size());
+	}
+	hasWork.notify_one();
+}
+
+void FrameCompressor::CompressNow(const void *raw, UINT32 bytes, CompressFunc compress, BYTE *scratch, CompressedFrame *out)
+{
+	Job job;
+	job.raw = raw;
+	job.rawBytes = bytes;
+	job.compress = compress;
+	job.pool = NULL;
+	job.out = out;
+	Store(job, scratch);
+}
+
+void FrameCompressor::Finish()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(!queue.empty() || busy > 0)
+			isIdle.wait(lock);
+		stopping = true;
+	}
+	hasWork.notify_all();
+	for(size_t w = 0; w < workers.size(); ++w)
+		workers[w].join();
+	workers.clear();
+}
+
+void FrameCompressor::Clear()
+{
+	arena.Clear();
+	std::lock_guard<std::mutex> lock(mutex);
+	rawBytes = 0;
+	compressedBytes = 0;
+	busyTicks = 0;
+	peakQueued = 0;
+}
+
+void FrameCompressor::Worker()
+{
+	std::vector<BYTE> scratch(scratchBytes);
+
+	for(;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while(queue.empty() && !stopping)
+				hasWork.wait(lock);
+			if(queue.empty())
+				return;
+			job = queue.front();
+			queue.pop_front();
+			++busy;
+		}
+
+		Store(job, &scratch[0]);
+		if(job.pool)
+			job.pool->Release(const_cast<void*>(job.raw));
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			--busy;
+		}
+		isIdle.notify_all();
+	}
+}
+
+// Compresses into scratch, then copies the exact size into the arena
+void FrameCompressor::Store(const Job &job, BYTE *scratch)
+{
+	LARGE_INTEGER t0, t1;
+	QueryPerformanceCounter(&t0);
+
+	size_t bytes = job.compress(job.raw, scratch);
+	BYTE *dst = arena.Allocate(bytes);
+	memcpy(dst, scratch, bytes);
+	job.out->bytes = (UINT32)bytes;
+	job.out->data = dst;
+
+	QueryPerformanceCounter(&t1);
+	job.out->storedTicks = t1.QuadPart;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	rawBytes += job.rawBytes;
+	compressedBytes += bytes;
+	busyTicks += t1.QuadPart - t0.QuadPart;
+}
+
+UINT64 FrameCompressor::RawBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return rawBytes;
+}
+
+UINT64 FrameCompressor::CompressedBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return compressedBytes;
+}
+
+double FrameCompressor::Ratio() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return compressedBytes > 0 ? (double)rawBytes / compressedBytes : 0.0;
+}
+
+double FrameCompressor::BusyMs() const
+{
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	std::lock_guard<std::mutex> lock(mutex);
+	return busyTicks * 1000.0 / freq.QuadPart;
+}
+
+int FrameCompressor::PeakQueued() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return peakQueued;
+}
@@ -0,0 +1,159 @@
+/*
+Compressed in-RAM frame store (-c).
+
+Without -c every captured frame stays in RAM uncompressed, which caps a
+capture at a couple of minutes on a 16GB machine. With -c the capture
+threads copy each frame into a raw slot from a small per-stream pool and
+hand it to a FrameCompressor. Its background workers compress the frame
+with the lossless codec in codec.h, append the result to a chunked arena
+and put the raw slot back into the pool straight away. Frames are
+decompressed again when they are filtered or dumped.
+
+Capture never waits for compression: if all raw slots are queued (the
+workers fall behind), the pool grows by one slot instead of dropping the
+frame, up to COMPRESS_MAX_RAW_SLOTS. Past that frames are dropped, which
+the sensor would do anyway if the capture thread blocked, and counted.
+RawSlotPool::Grown() and Dropped() tell how often that happened.
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+static const size_t ARENA_CHUNK_BYTES = 64 * 1024 * 1024;
+static const int COMPRESS_RAW_SLOTS = 15;		// Per stream, ~1/2 second of frames at 30 FPS
+static const int COMPRESS_MAX_RAW_SLOTS = 60;	// Per stream, the most the pool grows to. ~240MB of color
+static const float COMPRESS_EXPECTED_RATIO = 2.5f;	// Used for the RAM estimate before any frame is measured
+
+// A frame in the arena. data is NULL until a worker has stored it
+struct CompressedFrame
+{
+	const BYTE *data;
+	UINT32 bytes;
+	INT64 storedTicks;		// QueryPerformanceCounter() when it was stored
+};
+
+// Compresses raw (one frame) into dst and returns the compressed size
+typedef size_t (*CompressFunc)(const void *raw, BYTE *dst);
+
+// Append-only memory for compressed frames, allocated in big chunks. Freed all at once. Thread safe
+class CompressedArena
+{
+public:
+	CompressedArena();
+	~CompressedArena();
+
+	BYTE* Allocate(size_t bytes);
+	void Clear();
+
+	UINT64 BytesReserved() const;	// RAM taken by the chunks
+
+private:
+	mutable std::mutex mutex;
+	std::vector<BYTE*> chunks;
+	BYTE *cur;
+	size_t curLeft;
+	UINT64 reserved;
+
+	CompressedArena(const CompressedArena&);
+	CompressedArena& operator=(const CompressedArena&);
+};
+
+// Raw frame buffers for one capture thread. Acquire() allocates if the pool is empty, up to COMPRESS_MAX_RAW_SLOTS
+class RawSlotPool
+{
+public:
+	RawSlotPool();
+	~RawSlotPool();
+
+	void Init(size_t bytesPerSlot, int numSlots);
+	void Free();
+
+	// NULL (and counted as dropped) if all COMPRESS_MAX_RAW_SLOTS are waiting for compression
+	void* Acquire();
+	void Release(void *slot);
+
+	int Grown() const;		// Slots allocated because compression was behind
+	int Dropped() const;	// Acquire() failed because the pool was at its limit
+	UINT64 BytesAllocated() const;
+
+private:
+	mutable std::mutex mutex;
+	std::vector<BYTE*> all;
+	std::vector<BYTE*> available;
+	size_t bytesPerSlot;
+	int grown;
+	int dropped;
+
+	RawSlotPool(const RawSlotPool&);
+	RawSlotPool& operator=(const RawSlotPool&);
+};
+
+// Background compression workers shared by all streams
+class FrameCompressor
+{
+public:
+	FrameCompressor();
+	~FrameCompressor();
+
+	// scratchBytes is the largest CodecMaxBytes() of the streams that will be submitted
+	void Start(int numWorkers, size_t scratchBytes);
+
+	// Queues raw for compression into *out. raw goes back to pool once compressed
+	void Submit(const void *raw, UINT32 rawBytes, CompressFunc compress, RawSlotPool *pool, CompressedFrame *out);
+
+	// Compresses on the calling thread. For frames made after capture (filtered frames)
+	void CompressNow(const void *raw, UINT32 rawBytes, CompressFunc compress, BYTE *scratch, CompressedFrame *out);
+
+	// Waits until every submitted frame is stored, then stops the workers
+	void Finish();
+
+	// Drops all stored frames and resets the stats. Only after Finish()
+	void Clear();
+
+	UINT64 RawBytes() const;
+	UINT64 CompressedBytes() const;
+	double Ratio() const;			// RawBytes() / CompressedBytes(), 0 if nothing stored yet
+	double BusyMs() const;			// Worker time spent compressing, summed over workers
+	int PeakQueued() const;			// Most frames waiting at once
+
+	CompressedArena arena;
+
+private:
+	struct Job
+	{
+		const void *raw;
+		UINT32 rawBytes;
+		CompressFunc compress;
+		RawSlotPool *pool;
+		CompressedFrame *out;
+	};
+
+	void Worker();
+	void Store(const Job &job, BYTE *scratch);
+
+	mutable std::mutex mutex;
+	std::condition_variable hasWork;
+	std::condition_variable isIdle;
+	std::deque<Job> queue;
+	std::vector<std::thread> workers;
+	size_t scratchBytes;
+	int busy;
+	bool stopping;
+
+	UINT64 rawBytes;
+	UINT64 compressedBytes;
+	INT64 busyTicks;
+	int peakQueued;
+
+	FrameCompressor(const FrameCompressor&);
+	FrameCompressor& operator=(const FrameCompressor&);
+};
@@ -0,0 +1,254 @@
+/*
+Dump I/O scheduler. See iosched.h
+See main.cpp for license information.
+*/
+
+#include "iosched.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+IoScheduler::IoScheduler()
+	: poolBufferBytes(0), queuedBytes(0), stopping(false), isWriteThrough(false)
+	, bytesWritten(0), filesWritten(0), errors(0)
+{
+	for(int s = 0; s < IO_MAX_OPEN_FILES; ++s)
+	{
+		slots[s].file = INVALID_HANDLE_VALUE;
+		slots[s].event = NULL;
+		slots[s].buffer = NULL;
+	}
+}
+
+IoScheduler::~IoScheduler()
+{
+	Finish();
+}
+
+void IoScheduler::Start(bool writeThrough, size_t bufferBytes)
+{
+	if(pool.empty() || bufferBytes > poolBufferBytes)
+		AllocatePool(bufferBytes);
+	isWriteThrough = writeThrough;
+	stopping = false;
+	// Figures are per run: the soak test and --ioBench restart the scheduler
+	bytesWritten = 0;
+	filesWritten = 0;
+	errors = 0;
+	for(int s = 0; s < IO_MAX_OPEN_FILES; ++s)
+		if(!slots[s].event)
+			slots[s].event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	ioThread = std::thread(&IoScheduler::IoThread, this);
+}
+
+// About IO_QUEUE_MAX_BYTES of bufferBytes buffers, all free. Only while stopped
+void IoScheduler::AllocatePool(size_t bufferBytes)
+{
+	int numBuffers = std::max(IO_MIN_BUFFERS, (int)(IO_QUEUE_MAX_BYTES / bufferBytes));
+	pool.clear();
+	pool.resize(numBuffers);
+	freeBuffers.clear();
+	for(int b = 0; b < numBuffers; ++b)
+	{
+		pool[b].filename[0] = 0;
+		pool[b].data.reserve(bufferBytes);
+		freeBuffers.push_back(&pool[b]);
+	}
+	queue.clear();
+	queue.reserve(numBuffers);
+	extent.clear();
+	extent.reserve(numBuffers);
+	poolBufferBytes = bufferBytes;
+}
+
+IoBuffer* IoScheduler::Acquire()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while(freeBuffers.empty())
+		hasFree.wait(lock);
+	IoBuffer *buffer = freeBuffers.back();
+	freeBuffers.pop_back();
+	return buffer;
+}
+
+void IoScheduler::Discard(IoBuffer *buffer, const char *reason)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++errors;
+		std::cerr << reason << " " << buffer->filename << std::endl;
+		freeBuffers.push_back(buffer);
+	}
+	hasFree.notify_one();
+}
+
+void IoScheduler::Submit(IoBuffer *buffer)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(buffer);
+		queuedBytes += buffer->data.size();
+	}
+	hasWork.notify_one();
+}
+
+void IoScheduler::Finish()
+{
+	if(!ioThread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	hasWork.notify_one();
+	ioThread.join();
+
+	for(int s = 0; s < IO_MAX_OPEN_FILES; ++s)
+	{
+		if(slots[s].event)
+			CloseHandle(slots[s].event);
+		slots[s].event = NULL;
+	}
+}
+
+void IoScheduler::IoThread()
+{
+	for(;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			// Waiting a little for a full extent, unless we are flushing the rest
+			if(!stopping && queuedBytes < IO_EXTENT_BYTES)
+				hasWork.wait_for(lock, std::chrono::milliseconds(IO_GATHER_MS));
+			if(queue.empty()) {
+				if(stopping)
+					return;
+				continue;
+			}
+
+			size_t extentBytes = 0;
+			size_t taken = 0;
+			while(taken < queue.size() && extentBytes < IO_EXTENT_BYTES)
+			{
+				extentBytes += queue[taken]->data.size();
+				extent.push_back(queue[taken]);
+				++taken;
+			}
+			queue.erase(queue.begin(), queue.begin() + taken);
+		}
+
+		WriteExtent();
+
+		// Back to the pool. clear() keeps the capacity
+		size_t written = 0;
+		for(size_t j = 0; j < extent.size(); ++j)
+		{
+			written += extent[j]->data.size();
+			extent[j]->data.clear();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queuedBytes -= written;
+			freeBuffers.insert(freeBuffers.end(), extent.begin(), extent.end());
+		}
+		extent.clear();
+		hasFree.notify_all();
+	}
+}
+
+// Writes the files of the extent in file name order, keeping up to IO_MAX_OPEN_FILES writes in flight
+void IoScheduler::WriteExtent()
+{
+	std::sort(extent.begin(), extent.end(), [](const IoBuffer *a, const IoBuffer *b) { return strcmp(a->filename, b->filename) < 0; });
+
+	int next = 0;
+	for(size_t j = 0; j < extent.size(); ++j)
+	{
+		OpenFile &slot = slots[next];
+		if(slot.file != INVALID_HANDLE_VALUE)
+			EndWrite(slot);
+		if(!BeginWrite(slot, extent[j])) {
+			std::lock_guard<std::mutex> lock(mutex);
+			++errors;
+			std::cerr << "Problem writing " << extent[j]->filename << std::endl;
+		}
+		next = (next + 1) % IO_MAX_OPEN_FILES;
+	}
+
+	// Oldest first
+	for(int s = 0; s < IO_MAX_OPEN_FILES; ++s)
+	{
+		OpenFile &slot = slots[(next + s) % IO_MAX_OPEN_FILES];
+		if(slot.file != INVALID_HANDLE_VALUE)
+			EndWrite(slot);
+	}
+}
+
+bool IoScheduler::BeginWrite(OpenFile &slot, IoBuffer *buffer)
+{
+	DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN;
+	if(isWriteThrough)
+		flags |= FILE_FLAG_WRITE_THROUGH;
+	HANDLE file = CreateFileA(buffer->filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, flags, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Preallocating the whole file so it gets one contiguous run
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG)buffer->data.size();
+	SetFilePointerEx(file, size, NULL, FILE_BEGIN);
+	SetEndOfFile(file);
+
+	memset(&slot.overlapped, 0, sizeof(slot.overlapped));
+	ResetEvent(slot.event);
+	slot.overlapped.hEvent = slot.event;
+
+	if(!buffer->data.empty()
+		&& !WriteFile(file, &buffer->data[0], (DWORD)buffer->data.size(), NULL, &slot.overlapped)
+		&& GetLastError() != ERROR_IO_PENDING) {
+		CloseHandle(file);
+		return false;
+	}
+
+	slot.file = file;
+	slot.buffer = buffer;
+	return true;
+}
+
+// Waits for the write of slot to complete and closes its file
+void IoScheduler::EndWrite(OpenFile &slot)
+{
+	DWORD written = 0;
+	BOOL ok = slot.buffer->data.empty() || GetOverlappedResult(slot.file, &slot.overlapped, &written, TRUE);
+	CloseHandle(slot.file);
+	slot.file = INVALID_HANDLE_VALUE;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if(!ok || written != slot.buffer->data.size()) {
+		++errors;
+		std::cerr << "Problem writing " << slot.buffer->filename << std::endl;
+		return;
+	}
+	bytesWritten += written;
+	++filesWritten;
+}
+
+UINT64 IoScheduler::BytesWritten() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return bytesWritten;
+}
+
+int IoScheduler::FilesWritten() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return filesWritten;
+}
+
+int IoScheduler::Errors() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return errors;
+}
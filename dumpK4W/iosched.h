@@ -0,0 +1,115 @@
+/*
+Dump I/O scheduler.
+
+Without it every writer thread (depth, infra, color...) creates and writes
+its own small files at the same time, which on a spinning disk turns the
+dump into seek-bound random I/O. With it the writer threads only encode
+frames into buffers from the scheduler's pool (Acquire()) and Submit() the
+finished files. A single I/O thread
+gathers queued files into extents of about IO_EXTENT_BYTES, sorts each
+extent by file name (so every stream's frames land in order, one after
+another) and writes the files back to back:
+
+	- each file's full size is preallocated (SetEndOfFile) before its single
+	  WriteFile, so the file system can give it one contiguous run
+	- at most IO_MAX_OPEN_FILES files have writes in flight (overlapped I/O)
+	- writers block in Acquire() while every buffer is queued or being
+	  written, so encoding can't run away from the disk and eat the RAM
+
+The pool is allocated by Start(): about IO_QUEUE_MAX_BYTES worth of buffers
+big enough for the largest file. A buffer goes back to the pool once its
+file is written and keeps its capacity, so the dump loop doesn't allocate.
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+static const size_t IO_QUEUE_MAX_BYTES = 256 * 1024 * 1024;
+static const size_t IO_EXTENT_BYTES = 64 * 1024 * 1024;
+static const int IO_MAX_OPEN_FILES = 4;
+static const DWORD IO_GATHER_MS = 100;	// Longest wait for an extent to fill up
+static const size_t IO_DEFAULT_BUFFER_BYTES = 1024 * 1024;	// Depth sized tiffs
+static const int IO_MIN_BUFFERS = 16;
+
+// One file to write. Buffers belong to the scheduler's pool
+struct IoBuffer
+{
+	char filename[MAX_PATH];
+	std::vector<BYTE> data;		// Grows (once) if a file is bigger than the pool's buffer size
+};
+
+class IoScheduler
+{
+public:
+	IoScheduler();
+	~IoScheduler();
+
+	// isWriteThrough bypasses the OS write cache (for measuring the disk itself).
+	// bufferBytes is the size of the largest file expected. The pool is kept between runs unless it needs bigger buffers
+	void Start(bool isWriteThrough = false, size_t bufferBytes = IO_DEFAULT_BUFFER_BYTES);
+
+	// An empty buffer for the next file. Blocks while all buffers are queued or being written
+	IoBuffer* Acquire();
+
+	// Queues buffer->data to be written to buffer->filename. The buffer goes back to the pool once written
+	void Submit(IoBuffer *buffer);
+
+	// Gives buffer back to the pool unwritten, e.g. when encoding its file failed.
+	// Counted in Errors() and reported on cerr as "<reason> <filename>"
+	void Discard(IoBuffer *buffer, const char *reason);
+
+	// Writes out everything queued and stops the I/O thread
+	void Finish();
+
+	// Since the last Start()
+	UINT64 BytesWritten() const;
+	int FilesWritten() const;
+	int Errors() const;
+
+private:
+	// A file with its write in flight
+	struct OpenFile
+	{
+		HANDLE file;
+		OVERLAPPED overlapped;
+		HANDLE event;
+		IoBuffer *buffer;
+	};
+
+	void IoThread();
+	void AllocatePool(size_t bufferBytes);
+	void WriteExtent();
+	bool BeginWrite(OpenFile &slot, IoBuffer *buffer);
+	void EndWrite(OpenFile &slot);
+
+	mutable std::mutex mutex;
+	std::condition_variable hasWork;
+	std::condition_variable hasFree;
+	std::vector<IoBuffer> pool;
+	size_t poolBufferBytes;
+	std::vector<IoBuffer*> freeBuffers;
+	std::vector<IoBuffer*> queue;		// Oldest first
+	std::vector<IoBuffer*> extent;		// Being written. I/O thread only
+	size_t queuedBytes;
+	bool stopping;
+	bool isWriteThrough;
+	std::thread ioThread;
+
+	OpenFile slots[IO_MAX_OPEN_FILES];
+
+	UINT64 bytesWritten;
+	int filesWritten;
+	int errors;
+
+	IoScheduler(const IoScheduler&);
+	IoScheduler& operator=(const IoScheduler&);
+};
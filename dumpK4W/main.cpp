@@ -46,8 +46,10 @@ This is based on preliminary software and/or hardware, subject to change.
 
 #include <thread>
 #include <mutex>
+#include <atomic>
 
 #include <algorithm>
+#include <vector>
 
 // Command line arguments parser
 // http://tclap.sourceforge.net/manual.html
@@ -59,14 +61,37 @@ This is based on preliminary software and/or hardware, subject to change.
 // Performance information (memory etc)
 #include <Psapi.h>
 
-// VS2012 (VC11) doesn't have C++11 std round...
-namespace std
-{
-    int round(double d)
-    {
-        return static_cast<int>(d + 0.5);
-    }
-}
+// Depth/IR cleanup filters (flying pixels, IR masking, temporal median)
+#include "filters.h"
+#include "parallel.h"
+
+// YUY2 to gray / BGR, shared with the dump reader
+#include "colorconv.h"
+
+// Depth registered into 1080p color space (-z)
+#include "registration.h"
+
+// Per-frame quality statistics (flashing IR / depth detection)
+#include "analytics.h"
+
+// Live frame publishing to other processes through shared memory
+#include "framering.h"
+
+// Synthetic source benchmarks (no Kinect needed)
+#include "benchmarks.h"
+#include "synthetic.h"
+
+// Compressed in-RAM frame store (-c)
+#include "framestore.h"
+
+// Dump writes coalesced into sequential extents
+#include "iosched.h"
+
+// Stream traits for the templated capture / dump pipeline
+#include "streams.h"
+
+// Lock-free frame hand-off for the capture reactor (-r)
+#include "spscqueue.h"
 
 using namespace cv;
 using std::cout;
@@ -76,7 +101,6 @@ using std::thread;
 using std::mutex;
 using std::stringstream;
 using std::ofstream;
-using std::round;
 
 // TODO Do we need this?
 // Safe release for interfaces
@@ -91,13 +115,12 @@ inline void SafeRelease(Interface *& pInterfaceToRelease)
 }
 
 // Same for Depth and Infrared
-static const Size DEPTH_SIZE = Size(512, 424);
+static const Size DEPTH_SIZE = Size(DepthStream::WIDTH, DepthStream::HEIGHT);
 static const int DEPTH_DEPTH = 2;
 static const int DEPTH_PIXEL_TYPE = CV_16UC1;
-static const int DEPTH_MAGIC_NUMBER = 18;	// Scales depth up to allow OpenCV visualisation
 
 // Note that Raw color is YUY2 (Flipped UYVY)
-static const Size COLOR_SIZE = Size(1920, 1080);
+static const Size COLOR_SIZE = Size(ColorStream::WIDTH, ColorStream::HEIGHT);
 static const int COLOR_DEPTH = 2;
 //static const int COLOR_PIXEL_TYPE = CV_8UC2;
 
@@ -115,34 +138,37 @@ static const float HDD_MB_PER_FRAME_SET = 8.5f;
 static const float RAM_MB_PER_FRAME_SET = 4.8f;	
 static const float RAM_PADDING_RATIO = 1.2f;	// if(ramAvailable < ramEstimate * RAM_PADDING_RATIO) WARN
 static const float HDD_PADDING_RATIO = 2.0f;	// ditto for hdd space
+static const float RAM_MB_PER_FILTERED_SET = 0.9f;	// Extra filtered depth + IR per frame set (-f)
+static const float HDD_MB_PER_FILTERED_SET = 0.9f;	
+static const float RAM_MB_PER_BODY_INDEX = 0.2f;	// Extra per frame set with -b
+static const float HDD_MB_PER_BODY_INDEX = 0.2f;
+static const float RAM_MB_PER_LONG_INFRA = 0.45f;	// Extra per frame set with -e
+static const float HDD_MB_PER_LONG_INFRA = 0.45f;
+static const float HDD_MB_PER_REGISTERED_DEPTH = 4.0f;	// Extra per color frame with -z
+static const DWORD COMPRESS_WATCH_MS = 1000;	// How often the RAM use of the compressed store is checked (-c)
 
 // ---- Globals for the sake of convenience :) ----
 // Kinect v2 stuff
 static IKinectSensor* kinect = NULL;
-static IDepthFrameReader *depthReader = NULL;
-static IInfraredFrameReader *infraReader = NULL;
-static IColorFrameReader *colorReader = NULL;
 static ICoordinateMapper *coordMapper = NULL;
 
-// Frame Data buffers
-static Mat **depthImageArray = NULL;
-static Mat **infraImageArray = NULL;
-static UINT16 **depthBufArray = NULL;
-static UINT16 **infraBufArray = NULL;
-static BYTE **colorBufArray = NULL;
+// Frame data, time stamps etc of each stream (see streams.h)
+static StreamBuffers<DepthStream> depthData;
+static StreamBuffers<InfraStream> infraData;
+static StreamBuffers<ColorStream> colorData;
+static StreamBuffers<BodyIndexStream> bodyIndexData;
+static StreamBuffers<LongInfraStream> longInfraData;
+
+// Background compression of captured frames (-c, see framestore.h)
+static FrameCompressor frameCompressor;
 
-// Time Stamps (relative)
-static TIMESPAN *depthRelTimeArray = NULL;
-static TIMESPAN *infraRelTimeArray = NULL;
-static TIMESPAN *colorRelTimeArray = NULL;
+// Writes the files of all WriteStream threads in big sequential runs (see iosched.h)
+static IoScheduler ioScheduler;
 
-// Number of frames captured to RAM
-static int DEPTH_FRAMES_CAPTURED = 0;
-static int INFRA_FRAMES_CAPTURED = 0;
-static int COLOR_FRAMES_CAPTURED = 0;
+static const int LIVE_LATENCY_TEST_READERS = 2;	// Readers per stream in --liveLatencyTest
 
 // Signals
-static bool CAPTURE_DONE = false;	// Signal used by all threads. True => break loop
+static std::atomic<bool> CAPTURE_DONE(false);	// Stop token used by all threads. True => break loop
 
 // Mutex for I/O critical sections (cout mainly)
 static std::mutex ioMutex;
@@ -157,592 +183,1225 @@ static struct ProgramState
 	bool isSaveYUY2;		// Raw YUV from sensor
 	bool isSaveGray;		// Grayscale images (Y channel)
 	bool isSaveUnmapped;	// 1920x1080 images
+	bool isFilter;			// Also dump cleaned up depth and infra (see filters.h)
+	INT32 filterMedianFrames;
+	bool isAnalytics;		// Per-frame quality stats and flagged segments report
+	bool isLive;			// Publish frames to shared memory as they arrive (see framering.h)
+	bool isCompress;		// Keep frames compressed in RAM (see framestore.h)
+	bool isReactor;			// One reactor thread captures all streams (see ReactorCapture)
+	bool isRegisterDepth;	// Also dump depth registered into color space (see registration.h)
+	bool isRegisterBilinear;	// Bilinear splatting for isRegisterDepth
+	INT32 liveLatencyTestSec;	// > 0 => run the live ring benchmark instead of capturing
+	INT32 soakTestSec;			// > 0 => run the soak test instead of capturing
+	INT32 reactorBenchSec;		// > 0 => run the capture model benchmark instead of capturing
+	INT32 ioBenchSec;			// > 0 => run the dump I/O benchmark instead of capturing
+	INT32 readerBenchSec;		// > 0 => run the dump reader benchmark instead of capturing
+	INT32 colorBenchSec;		// > 0 => run the mapped color benchmark instead of capturing
 } programState;
 
-void ProcessDepth()
+// Index of the frame in timeArray (sorted, numFrames long) closest to time
+int FindNearestFrame(TIMESPAN time, const TIMESPAN *timeArray, int numFrames)
+{
+	if(numFrames <= 0)
+		return -1;
+
+	const TIMESPAN *it = std::lower_bound(timeArray, timeArray + numFrames, time);
+	int j = (int)(it - timeArray);
+	if(j >= numFrames)
+		return numFrames - 1;
+	if(j > 0 && time - timeArray[j-1] < timeArray[j] - time)
+		return j - 1;
+	return j;
+}
+
+// Opens the reader of one stream, subscribes to its frame arrived event and allocates its buffers
+template<class Stream>
+WAITABLE_HANDLE OpenStream(StreamBuffers<Stream> *data)
 {
 	HRESULT hr;
 
-	// Depth
-	IDepthFrameSource *depthSrc = NULL;
-	hr = kinect->get_DepthFrameSource(&depthSrc);
+	typename Stream::Source *src = NULL;
+	hr = Stream::GetSource(kinect, &src);
 	if(FAILED(hr)) exit(EXIT_FAILURE);
 
-	hr = depthSrc->OpenReader(&depthReader);
+	hr = src->OpenReader(&data->reader);
 	if(FAILED(hr)) exit(EXIT_FAILURE);
-	SafeRelease(depthSrc);
+	SafeRelease(src);
 
 	// Subscribing reader
-	WAITABLE_HANDLE depthHandle = 0;
-	hr = depthReader->SubscribeFrameArrived(&depthHandle);
+	WAITABLE_HANDLE handle = 0;
+	hr = data->reader->SubscribeFrameArrived(&handle);
 	if(FAILED(hr)) exit(EXIT_FAILURE);
 
+	data->Allocate(programState.maxFramesToCapture, programState.isAnalytics, programState.isCompress);
+	return handle;
+}
+
+// Copies the frame signalled on handle into frame i of data. *buf is set to the copy.
+// False if the frame could not be acquired (e.g. the sensor has moved on) or there is no raw slot for it (-c)
+template<class Stream>
+bool CopyArrivedFrame(StreamBuffers<Stream> *data, WAITABLE_HANDLE handle, int i, typename Stream::Pixel **buf)
+{
+	typename Stream::EventArgs *pArgs = nullptr;
+	data->reader->GetFrameArrivedEventData(handle, &pArgs);
+
+	typename Stream::FrameReference *frameRef = nullptr;
+	pArgs->get_FrameReference(&frameRef);
+
+	typename Stream::Frame *frame = NULL;
+
+	bool isCopied = SUCCEEDED(frameRef->AcquireFrame(&frame));
+	if(isCopied) 
+	{
+		*buf = data->CaptureBuffer(i);
+		isCopied = *buf != NULL;
+		if(isCopied) {
+			// Copying data from Kinect
+			Stream::CopyFrame(frame, *buf);
+
+			// Saving timestamp
+			frame->get_RelativeTime(data->relTimeArray + i);
+		}
+
+		frame->Release();
+	}
+
+	SafeRelease(frameRef);
+	pArgs->Release();
+	return isCopied;
+}
+
+// Everything done with a captured frame besides keeping it: analytics, live publishing and preview.
+// Then hands the frame to the compression workers with -c
+template<class Stream>
+void ProcessFrame(StreamBuffers<Stream> *data, int i, typename Stream::Pixel *buf, Mat &previewScratch)
+{
+	if(data->statsArray)
+		Stream::Analyze(data->analyzer, buf, data->statsArray + i);
+
+	if(data->ring.IsOpen())
+		data->ring.Publish(buf, data->BytesPerFrame(), data->relTimeArray[i]);
+
+	if(Stream::HAS_PREVIEW)
+		Stream::Preview(buf, previewScratch);
+
+	data->Store(i, buf, frameCompressor);
+}
+
+// Captures frames of one stream to RAM until we have enough, 'q' is pressed or another stream is done.
+// One thread per stream, specialised at compile time by the stream traits (see streams.h)
+template<class Stream>
+void ProcessStream(StreamBuffers<Stream> *data)
+{
+	WAITABLE_HANDLE handle = OpenStream(data);
+
 	// Getting frame to capture limit from cmd line arguments
 	INT32 MAX_FRAMES_TO_CAPTURE = programState.maxFramesToCapture;
-	
-	// Depth Data and Visualization Init
-	depthBufArray = new UINT16*[programState.maxFramesToCapture];
-	depthRelTimeArray = new TIMESPAN [programState.maxFramesToCapture];
-	depthImageArray = new Mat*[MAX_FRAMES_TO_CAPTURE];
-	memset(depthImageArray, 0, sizeof(Mat*)*MAX_FRAMES_TO_CAPTURE);
-	memset(depthBufArray, 0, sizeof(UINT16*)*MAX_FRAMES_TO_CAPTURE);
-	memset(depthRelTimeArray, 0, sizeof(TIMESPAN)*MAX_FRAMES_TO_CAPTURE);
-
-	for(int i = 0; i < MAX_FRAMES_TO_CAPTURE; ++i)
-		depthBufArray[i] = new UINT16[DEPTH_SIZE.area()];
-	namedWindow("Depth", WINDOW_AUTOSIZE);
-	Mat flippedDepth(DEPTH_SIZE, DEPTH_PIXEL_TYPE);		// K4W has things the wrong way around...
+
+	if(Stream::HAS_PREVIEW)
+		namedWindow(Stream::Name(), WINDOW_AUTOSIZE);
+	Mat previewScratch;
 
 	int i;
 	for(i = 0; i < MAX_FRAMES_TO_CAPTURE && !CAPTURE_DONE;)
 	{
-		DWORD ret = WaitForSingleObject((HANDLE)depthHandle, 200) ;
+		DWORD ret = WaitForSingleObject((HANDLE)handle, 200) ;
 
 		if(ret == WAIT_TIMEOUT) {
-			std::cerr << "!!!Depth Timeout!!!" << endl;
-			std::cerr << i << endl;
+			std::cerr << "!!!" << Stream::Name() << " Timeout!!!" << endl;
 		}
 		else if (ret != WAIT_OBJECT_0) {
-			std::cerr << "!!!Depth Error!!!" << endl;
+			std::cerr << "!!!" << Stream::Name() << " Error!!!" << endl;
 			if(ret == WAIT_FAILED)
 				std::cerr << GetLastError() << endl;
 		}
 		else {
-			if(!depthReader)
-				exit(EXIT_FAILURE);
-
-			IDepthFrameArrivedEventArgs* pArgs = nullptr;
-			depthReader->GetFrameArrivedEventData(depthHandle, &pArgs);
-
-			IDepthFrameReference *depthRef = nullptr;
-			pArgs->get_FrameReference(&depthRef);
-
-			//hr = depthReader->AcquireLatestFrame(&depthFrame);
-			IDepthFrame* depthFrame = NULL;
-
-			if(SUCCEEDED(depthRef->AcquireFrame(&depthFrame))) 
-			{
-				// Copying data from Kinect
-				depthFrame->CopyFrameDataToArray(DEPTH_SIZE.area(), depthBufArray[i]);
-
-				// Saving timestamp
-				depthFrame->get_RelativeTime(depthRelTimeArray + i);
-
-				depthFrame->Release();
-		
-				depthImageArray[i] = new Mat(DEPTH_SIZE, DEPTH_PIXEL_TYPE, depthBufArray[i], Mat::AUTO_STEP);
-
-				flip(*depthImageArray[i], flippedDepth, 1);	// Mirror about y axis
-				imshow("Depth", flippedDepth * DEPTH_MAGIC_NUMBER);
-
+			typename Stream::Pixel *buf;
+			if(CopyArrivedFrame(data, handle, i, &buf)) {
+				ProcessFrame(data, i, buf, previewScratch);
 				++i;	// Incrementing frame number
 			}
-
-			pArgs->Release();
 		}
 
 		if(waitKey(1) == 'q') {
 			break;
 		}
 	}
-	DEPTH_FRAMES_CAPTURED = i;
+	data->framesCaptured = i;
 	ioMutex.lock();
-		//cout << "ProcessDepth Thread DONE!!" << endl;
-		cout << "Depth frames in RAM: " << DEPTH_FRAMES_CAPTURED<< endl;
+		cout << Stream::Name() << " frames in RAM: " << data->framesCaptured << endl;
 	ioMutex.unlock();
 
 	CAPTURE_DONE = true;
 }
 
-void ProcessInfra()
+// ---- Reactor capture (-r) ----
+// Instead of a thread per stream, one reactor thread waits on the frame arrived events of all
+// streams at once and only copies frames out of the SDK, in the order they arrive. Copied frames
+// go through a lock-free queue to one processing thread, which does ProcessFrame() and owns the
+// preview windows and the 'q' key. Fewer threads waking up, and one arrival order across streams
+// (arrival_order.txt in the dump). WaitForMultipleObjects() only reports the lowest signalled
+// stream, so after each wakeup the reactor polls all streams and queues what it got by RelativeTime.
+
+static const int REACTOR_QUEUE_FRAMES = 256;	// Only fills up if processing stalls
+static const DWORD REACTOR_WAIT_MS = 200;		// Same timeout as ProcessStream()
+static const DWORD REACTOR_UI_MS = 33;			// Preview windows are serviced (waitKey) at most this often
+
+// A frame copied by the reactor, waiting for the processing thread
+struct CapturedFrame
 {
-	CAPTURE_DONE = false;	// We are not done yet!
+	int stream;			// Index into the reactor's stream table
+	int frameIdx;
+	void *buf;
+};
 
-	HRESULT hr;
+// Arrival order of frames across streams, filled in by the processing thread
+struct ArrivalRecord
+{
+	int stream;
+	int frameIdx;
+	TIMESPAN relTime;
+};
 
-	// Infrared
-	IInfraredFrameSource *infraSrc = NULL;
-	hr = kinect->get_InfraredFrameSource(&infraSrc);
-	if(FAILED(hr)) exit(EXIT_FAILURE);
+// Entry points of one stream, type-erased so the reactor can keep all streams in one table
+struct ReactorStream
+{
+	void *data;			// StreamBuffers<Stream>
+	const char *name;
+	bool hasPreview;
+	WAITABLE_HANDLE handle;
+	int framesCopied;
+
+	bool (*copy)(void *data, WAITABLE_HANDLE handle, int i, void **buf, TIMESPAN *relTime);
+	TIMESPAN (*process)(void *data, int i, void *buf, Mat &previewScratch);
+};
+
+template<class Stream>
+struct ReactorAdapter
+{
+	static bool Copy(void *data, WAITABLE_HANDLE handle, int i, void **buf, TIMESPAN *relTime)
+	{
+		StreamBuffers<Stream> *buffers = static_cast<StreamBuffers<Stream>*>(data);
+		typename Stream::Pixel *pixels;
+		if(!CopyArrivedFrame(buffers, handle, i, &pixels))
+			return false;
+		*buf = pixels;
+		*relTime = buffers->relTimeArray[i];
+		return true;
+	}
 
-	hr = infraSrc->OpenReader(&infraReader);
-	if(FAILED(hr)) exit(EXIT_FAILURE);
-	SafeRelease(infraSrc);
+	// Frames of a stream are processed in order, so frame i done => i + 1 captured
+	static TIMESPAN Process(void *data, int i, void *buf, Mat &previewScratch)
+	{
+		StreamBuffers<Stream> *buffers = static_cast<StreamBuffers<Stream>*>(data);
+		ProcessFrame(buffers, i, static_cast<typename Stream::Pixel*>(buf), previewScratch);
+		buffers->framesCaptured = i + 1;
+		return buffers->relTimeArray[i];
+	}
+};
 
-	// Subscribing reader
-	WAITABLE_HANDLE infraHandle = 0;
-	infraReader->SubscribeFrameArrived(&infraHandle);
-	if(FAILED(hr)) exit(EXIT_FAILURE);
-	
-	// Getting frame to capture limit from cmd line arguments
-	INT32 MAX_FRAMES_TO_CAPTURE = programState.maxFramesToCapture;
+template<class Stream>
+ReactorStream MakeReactorStream(StreamBuffers<Stream> *data)
+{
+	ReactorStream s;
+	s.data = data;
+	s.name = Stream::Name();
+	s.hasPreview = Stream::HAS_PREVIEW;
+	s.handle = OpenStream(data);
+	s.framesCopied = 0;
+	s.copy = &ReactorAdapter<Stream>::Copy;
+	s.process = &ReactorAdapter<Stream>::Process;
+	return s;
+}
 
-	infraBufArray = new UINT16*[programState.maxFramesToCapture];
-	infraRelTimeArray = new TIMESPAN [programState.maxFramesToCapture];
-	infraImageArray = new Mat*[MAX_FRAMES_TO_CAPTURE];
-	memset(infraImageArray, 0, sizeof(Mat*)*MAX_FRAMES_TO_CAPTURE);
-	memset(infraBufArray, 0, sizeof(UINT16*)*MAX_FRAMES_TO_CAPTURE);
-	memset(infraRelTimeArray, 0, sizeof(TIMESPAN)*MAX_FRAMES_TO_CAPTURE);
-	
-	for(int i = 0; i < MAX_FRAMES_TO_CAPTURE; ++i)
-		infraBufArray[i] = new UINT16[DEPTH_SIZE.area()];
-	namedWindow("Infra", WINDOW_AUTOSIZE);	
-	Mat flippedInfra(DEPTH_SIZE, DEPTH_PIXEL_TYPE);		// K4W has things the wrong way around...
+static std::vector<ArrivalRecord> arrivalOrder;
+static std::vector<const char*> arrivalStreamNames;
 
-	int i;
-	for(i = 0; i < MAX_FRAMES_TO_CAPTURE && !CAPTURE_DONE;)
+// Waits on all streams, copies frames in arrival order and queues them. Stops when any stream
+// has all its frames (like ProcessStream()) or on CAPTURE_DONE
+static void ReactorCapture(std::vector<ReactorStream> *streams, SpscQueue<CapturedFrame> *queue
+	, HANDLE workEvent, std::atomic<bool> *isReactorDone)
+{
+	std::vector<HANDLE> handles;
+	for(size_t s = 0; s < streams->size(); ++s)
+		handles.push_back((HANDLE)(*streams)[s].handle);
+	const int MAX_FRAMES_TO_CAPTURE = programState.maxFramesToCapture;
+
+	// Frames copied after one wakeup, at most one per stream
+	std::vector<CapturedFrame> arrived;
+	std::vector<TIMESPAN> arrivedTimes;
+	arrived.reserve(handles.size());
+	arrivedTimes.reserve(handles.size());
+
+	while(!CAPTURE_DONE)
 	{
-		DWORD ret = WaitForSingleObject((HANDLE)infraHandle, 200) ;
+		DWORD ret = WaitForMultipleObjects((DWORD)handles.size(), &handles[0], FALSE, REACTOR_WAIT_MS);
 
 		if(ret == WAIT_TIMEOUT) {
-			std::cerr << "!!!Infra Timeout!!!" << endl;
+			std::cerr << "!!!Reactor Timeout!!!" << endl;
+			continue;
 		}
-		else if (ret != WAIT_OBJECT_0) {
-			std::cerr << "!!!Infra Error!!!" << endl;
+		if(ret < WAIT_OBJECT_0 || ret >= WAIT_OBJECT_0 + handles.size()) {
+			std::cerr << "!!!Reactor Error!!!" << endl;
 			if(ret == WAIT_FAILED)
 				std::cerr << GetLastError() << endl;
+			continue;
 		}
-		else {
-			if(!infraReader)
-				exit(EXIT_FAILURE);
-
-			IInfraredFrameArrivedEventArgs* pArgs = nullptr;
-			infraReader->GetFrameArrivedEventData(infraHandle, &pArgs);
-
-			IInfraredFrameReference *infraRef = nullptr;
-			pArgs->get_FrameReference(&infraRef);
-
-			//hr = depthReader->AcquireLatestFrame(&depthFrame);
-			IInfraredFrame* infraFrame = NULL;
-
-			if(SUCCEEDED(infraRef->AcquireFrame(&infraFrame))) 
-			{
-				// Copying data from Kinect
-				infraFrame->CopyFrameDataToArray(DEPTH_SIZE.area(), infraBufArray[i]);
 
-				// Saving timestamp
-				infraFrame->get_RelativeTime(infraRelTimeArray + i);
+		// The stream that woke us up is only the lowest signalled one. Collecting every stream with a
+		// frame waiting, then queueing by RelativeTime, keeps the order independent of stream index
+		arrived.clear();
+		arrivedTimes.clear();
+		int woken = (int)(ret - WAIT_OBJECT_0);
+		for(int idx = 0; idx < (int)handles.size(); ++idx)
+		{
+			if(idx != woken && WaitForSingleObject(handles[idx], 0) != WAIT_OBJECT_0)
+				continue;
+			ReactorStream &stream = (*streams)[idx];
+			CapturedFrame frame;
+			TIMESPAN relTime;
+			if(!stream.copy(stream.data, stream.handle, stream.framesCopied, &frame.buf, &relTime))
+				continue;
+			frame.stream = idx;
+			frame.frameIdx = stream.framesCopied++;
+
+			// Insertion by RelativeTime. Equal times keep stream order
+			size_t pos = arrived.size();
+			while(pos > 0 && arrivedTimes[pos - 1] > relTime)
+				--pos;
+			arrived.insert(arrived.begin() + pos, frame);
+			arrivedTimes.insert(arrivedTimes.begin() + pos, relTime);
+
+			if(stream.framesCopied >= MAX_FRAMES_TO_CAPTURE)
+				CAPTURE_DONE = true;
+		}
 
-				infraFrame->Release();
-		
-				infraImageArray[i] = new Mat(DEPTH_SIZE, DEPTH_PIXEL_TYPE, infraBufArray[i], Mat::AUTO_STEP);
+		// Full only if processing stalls. Waiting holds up the sensors like a slow capture thread would
+		for(size_t a = 0; a < arrived.size(); ++a)
+		{
+			while(!queue->Push(arrived[a]))
+				std::this_thread::yield();
+		}
+		if(!arrived.empty())
+			SetEvent(workEvent);
+	}
 
-				flip(*infraImageArray[i], flippedInfra, 1);	// Mirror about y axis
-				imshow("Infra", flippedInfra);
+	*isReactorDone = true;
+	SetEvent(workEvent);
+}
 
+// Captures all enabled streams with one reactor thread, processing frames on the calling thread
+void ReactorCaptureAll()
+{
+	std::vector<ReactorStream> streams;
+	streams.push_back(MakeReactorStream(&depthData));
+	streams.push_back(MakeReactorStream(&infraData));
+	streams.push_back(MakeReactorStream(&colorData));
+	if(bodyIndexData.isEnabled)
+		streams.push_back(MakeReactorStream(&bodyIndexData));
+	if(longInfraData.isEnabled)
+		streams.push_back(MakeReactorStream(&longInfraData));
+
+	arrivalStreamNames.clear();
+	for(size_t s = 0; s < streams.size(); ++s)
+		arrivalStreamNames.push_back(streams[s].name);
+	arrivalOrder.clear();
+	arrivalOrder.reserve(streams.size() * programState.maxFramesToCapture);
+
+	// HighGUI windows belong to the processing thread
+	std::vector<Mat> previewScratch(streams.size());
+	for(size_t s = 0; s < streams.size(); ++s)
+		if(streams[s].hasPreview)
+			namedWindow(streams[s].name, WINDOW_AUTOSIZE);
+
+	SpscQueue<CapturedFrame> queue(REACTOR_QUEUE_FRAMES);
+	HANDLE workEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	std::atomic<bool> isReactorDone(false);
+	thread reactor(&ReactorCapture, &streams, &queue, workEvent, &isReactorDone);
+
+	INT64 lastUiTicks = getTickCount();
+	for(;;)
+	{
+		WaitForSingleObject(workEvent, REACTOR_UI_MS);
 
-				++i;	// Incrementing frame number
-			}
+		// Read before draining: once the reactor is done, everything it queued is visible
+		bool isDone = isReactorDone;
 
-			pArgs->Release();
+		CapturedFrame frame;
+		while(queue.Pop(&frame))
+		{
+			ReactorStream &stream = streams[frame.stream];
+			ArrivalRecord record;
+			record.stream = frame.stream;
+			record.frameIdx = frame.frameIdx;
+			record.relTime = stream.process(stream.data, frame.frameIdx, frame.buf, previewScratch[frame.stream]);
+			arrivalOrder.push_back(record);
 		}
 
-		if(waitKey(1) == 'q') {
+		if(isDone)
 			break;
+
+		// One waitKey() per UI period for all windows, not one per frame per stream
+		if((getTickCount() - lastUiTicks) * 1000 / getTickFrequency() >= REACTOR_UI_MS) {
+			if(waitKey(1) == 'q')
+				CAPTURE_DONE = true;
+			lastUiTicks = getTickCount();
 		}
-	}	
-	INFRA_FRAMES_CAPTURED = i;
+	}
+	reactor.join();
+	CloseHandle(workEvent);
+
 	ioMutex.lock();
-		//cout << "ProcessInfra Thread DONE!!" << endl;
-		cout << "Infra frames in RAM: " << INFRA_FRAMES_CAPTURED << endl;
+		cout << "Reactor frames in RAM:";
+		for(size_t s = 0; s < streams.size(); ++s)
+			cout << " " << streams[s].name << " " << streams[s].framesCopied;
+		cout << endl;
 	ioMutex.unlock();
+}
 
-	CAPTURE_DONE = true;
+// arrival_order.txt: frames of all streams in the order the reactor copied them (-r). Frames
+// found waiting at the same wakeup are ordered by RelativeTime, equal times by stream
+void WriteArrivalOrder()
+{
+	ofstream out(programState.dumpPath + "arrival_order.txt");
+	if(out.bad()) {
+		cerr << "Problem opening arrival_order.txt" << endl;
+		return;
+	}
+	out << "arrival_idx" << "\t" << "stream" << "\t" << "frame_idx" << "\t" << "RelativeTime" << endl;
+	for(size_t a = 0; a < arrivalOrder.size(); ++a)
+	{
+		const ArrivalRecord &r = arrivalOrder[a];
+		out << a << "\t" << arrivalStreamNames[r.stream] << "\t" << r.frameIdx << "\t" << r.relTime << endl;
+	}
 }
 
-void ProcessColor()
+// Stand-in for MapDepthFrameToColorSpace() without a Kinect (--soakTest). Roughly the real
+// geometry (color ~3x the depth resolution, shifted by disparity), only good for timing the dump
+static void MapDepthToColorApprox(const UINT16 *depth, int numPixels, ColorSpacePoint *colorPoints)
 {
-	HRESULT hr;
+	for(int j = 0; j < numPixels; ++j)
+	{
+		int u = j % DEPTH_SIZE.width;
+		int v = j / DEPTH_SIZE.width;
+		if(depth[j] == 0) {
+			colorPoints[j].X = colorPoints[j].Y = -1.0f;	// Invalid depth maps nowhere
+			continue;
+		}
+		colorPoints[j].X = COLOR_SIZE.width / 2 + (u - DEPTH_SIZE.width / 2) * 2.9f + 52000.0f / depth[j];
+		colorPoints[j].Y = COLOR_SIZE.height / 2 + (v - DEPTH_SIZE.height / 2) * 2.9f;
+	}
+}
 
-	// Color		
-	IColorFrameSource *colorSrc = NULL;
-	hr = kinect->get_ColorFrameSource(&colorSrc);
-	if(FAILED(hr)) exit(EXIT_FAILURE);
+// Writes everything derived from one color frame: raw YUY2, gray and rgb at 1080p
+// and mapped to depth space using the depth frame closest in time.
+// Each dump thread has its own encoder, which is its workspace: buffers and the file name are
+// allocated once (only the buffers the enabled outputs need) and reused for every frame.
+class ColorEncoder
+{
+public:
+	ColorEncoder(const std::string &dumpPath, bool isVerbose, IoScheduler *io)
+		: dumpPath(dumpPath), isVerbose(isVerbose), io(io)
+	{
+		bool isGray = programState.isSaveGray;
+		bool isUnmapped = programState.isSaveUnmapped;
+		grayBuf = isGray && isUnmapped ? new BYTE[COLOR_SIZE.area()] : NULL;	// Y channel data of YUY2
+		rgbBuf = isUnmapped ? new BYTE[COLOR_SIZE.area() * 3] : NULL;
+		depthInColorSpace = new ColorSpacePoint[DEPTH_SIZE.area()];
+		grayBufMapped = isGray ? new BYTE[DEPTH_SIZE.area()] : NULL;
+		rgbBufMapped = new BYTE[DEPTH_SIZE.area()*3];
+		depthScratch = new UINT16[DEPTH_SIZE.area()];	// Decompressed depth (-c)
+	}
 
-	hr = colorSrc->OpenReader(&colorReader);
-	if(FAILED(hr)) exit(EXIT_FAILURE);
-	SafeRelease(colorSrc);
+	~ColorEncoder()
+	{
+		delete [] grayBuf;
+		delete [] rgbBuf;
+		delete [] depthInColorSpace;
+		delete [] grayBufMapped;
+		delete [] rgbBufMapped;
+		delete [] depthScratch;
+	}
 
-	// Subscribing reader
-	WAITABLE_HANDLE colorHandle = 0;
-	colorReader->SubscribeFrameArrived(&colorHandle);
-	if(FAILED(hr)) exit(EXIT_FAILURE);
+	void Encode(const std::string &/*prefix*/, int i, const BYTE *colorBuf, TIMESPAN relTime);
 
-	// Getting frame to capture limit from cmd line arguments
-	INT32 MAX_FRAMES_TO_CAPTURE = programState.maxFramesToCapture;
+private:
+	std::string dumpPath;
+	bool isVerbose;
+	IoScheduler *io;
 
-	colorBufArray = new BYTE*[programState.maxFramesToCapture];
-	colorRelTimeArray = new TIMESPAN [programState.maxFramesToCapture];
-	memset(colorBufArray, 0, sizeof(BYTE*)*MAX_FRAMES_TO_CAPTURE);
-	memset(colorRelTimeArray, 0, sizeof(TIMESPAN)*MAX_FRAMES_TO_CAPTURE);
+	BYTE *grayBuf;
+	BYTE *rgbBuf;
+	ColorSpacePoint *depthInColorSpace;
+	BYTE *grayBufMapped;
+	BYTE *rgbBufMapped;
+	UINT16 *depthScratch;
+	char filename[MAX_PATH];
 
-	for(int i = 0; i < MAX_FRAMES_TO_CAPTURE; ++i)
-		colorBufArray[i] = new BYTE[COLOR_SIZE.area()*COLOR_DEPTH];
-	//namedWindow("Color", WINDOW_AUTOSIZE);
+	ColorEncoder(const ColorEncoder&);
+	ColorEncoder& operator=(const ColorEncoder&);
+};
 
-	int i;
-	for(i = 0; i < MAX_FRAMES_TO_CAPTURE && !CAPTURE_DONE;)
-	{
+void ColorEncoder::Encode(const std::string &/*prefix*/, int i, const BYTE *colorBuf, TIMESPAN relTime)
+{
+	const std::string &DUMP_PATH = dumpPath;
 
-		DWORD ret = WaitForSingleObject((HANDLE)colorHandle, 200) ;
+	if(programState.isSaveYUY2) {
+		// Dumping YUY2 raw color to files
+		FrameFilename(filename, DUMP_PATH, "yuyv", i, ".yuv");
 
-		if(ret == WAIT_TIMEOUT) {
-			std::cerr << "!!!Color Timeout!!!" << endl;
-		}
-		else if (ret != WAIT_OBJECT_0) {
-			std::cerr << "!!!Color Error!!!" << endl;
-			if(ret == WAIT_FAILED)
-				std::cerr << GetLastError() << endl;
-		}
-		else {
-			if(!colorReader)
-				exit(EXIT_FAILURE);
+		if(isVerbose)
+			cout << "Writing: " << filename << endl;
+		SaveRaw(io, filename, colorBuf, COLOR_SIZE.area() * COLOR_DEPTH);
+	}
 
-			IColorFrameArrivedEventArgs* pArgs = nullptr;
-			colorReader->GetFrameArrivedEventData(colorHandle, &pArgs);
+	// 1080p images are only made when they are saved. The mapped images are sampled from YUY2 directly
+	if(programState.isSaveGray && programState.isSaveUnmapped) {
+		YUY2ToGray(colorBuf, COLOR_SIZE.area(), grayBuf);
+		Mat gray(COLOR_SIZE, CV_8UC1, grayBuf, Mat::AUTO_STEP);
 
-			IColorFrameReference *colorRef = nullptr;
-			pArgs->get_FrameReference(&colorRef);
+		// Using OpenCV Mat header to wrap and save
+		FrameFilename(filename, DUMP_PATH, "gray", i, ".tiff");
 
-			//hr = infraReader->AcquireLatestFrame(&infraFrame);
-			IColorFrame* colorFrame = NULL;
+		if(isVerbose)
+			cout << "Writing: " << filename << endl;		
+		SaveImage(io, filename, gray);		
+	}
 
-			if(SUCCEEDED(colorRef->AcquireFrame(&colorFrame))) 
-			{
-				// Copying data from Kinect
-				colorFrame->CopyRawFrameDataToArray(COLOR_SIZE.area()*COLOR_DEPTH, reinterpret_cast<BYTE*>(colorBufArray[i]));
+	if(programState.isSaveUnmapped) {
+		YUY2ToBGR(colorBuf, COLOR_SIZE.area(), rgbBuf);
+		Mat rgb(COLOR_SIZE, CV_8UC3, rgbBuf, Mat::AUTO_STEP);
 
-				// Saving timestamp
-				colorFrame->get_RelativeTime(colorRelTimeArray + i);
+		FrameFilename(filename, DUMP_PATH, "rgb", i, ".tiff");
 
-				colorFrame->Release();
+		if(isVerbose)
+			cout << "Writing: " << filename << endl;		
+		SaveImage(io, filename, rgb);	
+	}
 
-				// TODO How to visualise RGB? Maybe just show Y channel (C1)
-				//colorImageArray[cc] = new Mat(COLOR_SIZE, COLOR_PIXEL_TYPE, colorBufArray[cc], Mat::AUTO_STEP);
-				//imshow("Color", *colorImageArray[cc]);
+	// REMAP TO DEPTH SPACE
+	// TODO speed up with LUT?
+	// TODO dump depth coords?
+	// TODO can speed this up if we guess 15FPS etc
 
-				++i;
-			}
+	// Finding nearest depthBuffer in terms of Relative Time
+	int lastDepthIdx = depthData.framesCaptured-1;
+	for(int j = 0; j < depthData.framesCaptured; ++j)
+	{
+		if(relTime < depthData.relTimeArray[j]) {
+			lastDepthIdx = j-1;
+			break;
+		}
+	}
+
+	// TODO temporary fix. Needs better solution e.g finding nearest depth or assuming zeros for Depth
+	if(lastDepthIdx < 0) lastDepthIdx = 0;
 
-			pArgs->Release();
+	if(depthData.framesCaptured > 0) {
+		const UINT16 *depthBuf = depthData.Frame(lastDepthIdx, depthScratch);
+		HRESULT hr = S_OK;
+		if(coordMapper)
+			hr = coordMapper->MapDepthFrameToColorSpace(DEPTH_SIZE.area(), depthBuf
+				, DEPTH_SIZE.area(), depthInColorSpace);
+		else
+			MapDepthToColorApprox(depthBuf, DEPTH_SIZE.area(), depthInColorSpace);
+		if(FAILED(hr)) {
+			std::cerr << "COLOR MAPPING FAILED!!" << endl;
+			std::cerr << (unsigned long)hr << endl;
+			exit(EXIT_FAILURE);	
 		}
 
-		if(waitKey(1) == 'q') {
-			break;
+		// One pass makes both mapped images
+		YUY2SampleMapped(colorBuf, COLOR_SIZE.width, COLOR_SIZE.height, &depthInColorSpace[0].X, DEPTH_SIZE.area()
+			, grayBufMapped, rgbBufMapped);
+
+		if(programState.isSaveGray) {
+			Mat grayMapped = Mat(DEPTH_SIZE, CV_8UC1, grayBufMapped, Mat::AUTO_STEP);
+
+			FrameFilename(filename, DUMP_PATH, "grayMapped", i, ".tiff");
+
+			if(isVerbose)
+				cout << "Writing: " << filename << endl;		
+			SaveImage(io, filename, grayMapped);
+		}
+
+		Mat rgbMapped =  Mat(DEPTH_SIZE, CV_8UC3, rgbBufMapped, Mat::AUTO_STEP);
+
+		FrameFilename(filename, DUMP_PATH, "rgbMapped", i, ".tiff");
+
+		if(isVerbose)
+			cout << "Writing: " << filename << endl;		
+		SaveImage(io, filename, rgbMapped);
+	}
+}
+
+static const int REGISTER_BATCH_FRAMES_PER_WORKER = 2;	// Color frames per worker mapped ahead of registration (-z)
+
+// Depth frames mapped to color space ahead of registration, for a batch of color frames
+struct MappedDepthBatch
+{
+	std::vector<UINT16> scratch;			// Frames that aren't in RAM as is (compressed)
+	std::vector<ColorSpacePoint> points;
+	std::vector<const UINT16*> depth;		// Per mapped depth frame
+	std::vector<int> mappedIdx;				// Per color frame of the batch, index into depth / points
+};
+
+// Maps the depth frames closest to color frames [begin, end) into batch, each one once.
+// The only place registration touches the ICoordinateMapper, so it is used from one thread at a time.
+static void MapDepthBatch(int begin, int end, MappedDepthBatch *batch)
+{
+	const int numPixels = DEPTH_SIZE.area();
+	int lastDepthIdx = -1;
+	int numMapped = 0;
+	for(int i = begin; i < end; ++i)
+	{
+		int depthIdx = FindNearestFrame(colorData.relTimeArray[i], depthData.relTimeArray, depthData.framesCaptured);
+		if(depthIdx != lastDepthIdx) {
+			UINT16 *scratch = &batch->scratch[(size_t)numMapped * numPixels];
+			const UINT16 *depthBuf = depthData.HasFiltered() ? depthData.FilteredFrame(depthIdx, scratch) 
+				: depthData.Frame(depthIdx, scratch);
+			ColorSpacePoint *points = &batch->points[(size_t)numMapped * numPixels];
+			if(coordMapper) {
+				HRESULT hr = coordMapper->MapDepthFrameToColorSpace(numPixels, depthBuf, numPixels, points);
+				if(FAILED(hr)) {
+					std::cerr << "COLOR MAPPING FAILED!!" << endl;
+					exit(EXIT_FAILURE);
+				}
+			}
+			else
+				MapDepthToColorApprox(depthBuf, numPixels, points);
+			batch->depth[numMapped] = depthBuf;
+			lastDepthIdx = depthIdx;
+			++numMapped;
 		}
+		batch->mappedIdx[i - begin] = numMapped - 1;
 	}
+}
 
-	// TODO do we need this if we have COLOR_FRAMES_CAPTURED?
-	// We need this as all colorBufArray values are non-zero (aka valid)
-	if(i < MAX_FRAMES_TO_CAPTURE) {
-		delete [] colorBufArray[i];
-		colorBufArray[i] = NULL;
+// Dumps a 1920x1080 depth image registered into color space for every color frame, from the
+// depth frame closest in time (filtered if -f). Runs after the other streams are dumped, parallel over frames.
+// Frames go in batches: while the workers register one batch, the next one is mapped on another thread.
+void WriteRegisteredDepth()
+{
+	const std::string DUMP_PATH = programState.dumpPath;
+	const int numWorkers = NumWorkerThreads();
+	const int numColor = colorData.framesCaptured;
+	const int numDepth = depthData.framesCaptured;
+	const int numRegistered = numDepth > 0 ? numColor : 0;
+	const int batchFrames = numWorkers * REGISTER_BATCH_FRAMES_PER_WORKER;
+	INT64 startTicks = getTickCount();
+
+	// Per worker workspaces
+	std::vector<DepthRegistration> registrations(numWorkers);
+	for(int w = 0; w < numWorkers; ++w)
+		registrations[w].Init(DEPTH_SIZE.width, DEPTH_SIZE.height, COLOR_SIZE.width, COLOR_SIZE.height);
+	std::vector<UINT16> registered((size_t)numWorkers * COLOR_SIZE.area());
+
+	// Double buffered
+	MappedDepthBatch batches[2];
+	for(int k = 0; k < 2; ++k) {
+		batches[k].scratch.resize((size_t)batchFrames * DEPTH_SIZE.area());
+		batches[k].points.resize((size_t)batchFrames * DEPTH_SIZE.area());
+		batches[k].depth.resize(batchFrames);
+		batches[k].mappedIdx.resize(batchFrames);
 	}
 
-	COLOR_FRAMES_CAPTURED = i;
+	if(numRegistered > 0)
+		MapDepthBatch(0, std::min(batchFrames, numRegistered), &batches[0]);
+	for(int begin = 0, k = 0; begin < numRegistered; begin += batchFrames, k ^= 1)
+	{
+		const int end = std::min(begin + batchFrames, numRegistered);
+		const MappedDepthBatch &batch = batches[k];
+
+		std::thread mapper;
+		if(end < numRegistered)
+			mapper = std::thread(MapDepthBatch, end, std::min(end + batchFrames, numRegistered), &batches[k ^ 1]);
+
+		ParallelForFrames(end - begin, numWorkers, [&](int worker, int b) {
+			const int i = begin + b;
+			const int m = batch.mappedIdx[b];
+			UINT16 *out = &registered[(size_t)worker * COLOR_SIZE.area()];
+			registrations[worker].Register(batch.depth[m], &batch.points[(size_t)m * DEPTH_SIZE.area()].X
+				, programState.isRegisterBilinear, out);
+
+			char filename[MAX_PATH];
+			FrameFilename(filename, DUMP_PATH, "depthRegistered", i, ".tiff");
+			if(programState.isVerbose) {
+				ioMutex.lock();
+					cout << "Writing: " << filename << endl;
+				ioMutex.unlock();
+			}
+			SaveImage(&ioScheduler, filename, Mat(COLOR_SIZE, CV_16UC1, out, Mat::AUTO_STEP));
+		});
 
+		if(mapper.joinable())
+			mapper.join();
+	}
+
+	double ms = (getTickCount() - startTicks) * 1000.0 / getTickFrequency();
 	ioMutex.lock();
-		//cout << "ProcessColor Thread DONE!!" << endl;
-		cout << "Color Frames in RAM: " << COLOR_FRAMES_CAPTURED << endl;
+		cout << "Registered depth frames written: " << numRegistered << " in " << ms << "ms";
+		if(ms > 0 && numRegistered > 0)
+			cout << " (" << numRegistered * 1000.0 / ms << " FPS)";
+		cout << endl;
 	ioMutex.unlock();
+}
 
-	CAPTURE_DONE = true;
+// Cleans up captured depth and infra frames in RAM (see filters.h). Runs after capture
+// and before the dump, parallel over frames. Raw frames are kept for dumping alongside.
+// With -c frames are decompressed through per-worker window caches and the results compressed again.
+void FilterDepthInfra()
+{
+	const int numPixels = DEPTH_SIZE.area();
+	const int numWorkers = NumWorkerThreads();
+	INT64 startTicks = getTickCount();
+	const int numDepth = depthData.framesCaptured;
+	const int numInfra = infraData.framesCaptured;
+
+	// Per worker: decompressed windows, filter output and codec scratch (only used with -c)
+	std::vector<FrameWindowCache<InfraStream> > infraWindows(numWorkers);
+	std::vector<FrameWindowCache<DepthStream> > depthWindows(numWorkers);
+	for(int w = 0; w < numWorkers; ++w) {
+		infraWindows[w].Init(&infraData, programState.filterMedianFrames);
+		depthWindows[w].Init(&depthData, programState.filterMedianFrames);
+	}
+	const size_t codecBytes = StreamBuffers<DepthStream>::MaxCompressedBytes();
+	std::vector<BYTE> codecScratch(depthData.IsCompressed() ? (size_t)numWorkers * codecBytes : 1);
+	std::vector<UINT16> outScratch((size_t)numWorkers * numPixels);
+
+	// Infra first: temporal median only. The result is then used to mask depth.
+	infraData.AllocateFiltered();
+
+	ParallelForFrames(numInfra, numWorkers, [&](int worker, int i) {
+		const UINT16 *window[FILTER_MAX_MEDIAN_FRAMES];
+		int first;
+		int n = TemporalWindow(i, numInfra, programState.filterMedianFrames, &first);
+		for(int f = 0; f < n; ++f)
+			window[f] = infraWindows[worker].Get(first + f);
+
+		UINT16 *filtered = infraData.FilteredTarget(i, &outScratch[(size_t)worker * numPixels]);
+		TemporalMedian(window, n, numPixels, filtered);
+		infraData.StoreFiltered(i, filtered, &codecScratch[0] + worker * codecBytes, frameCompressor);
+	});
+
+	// Depth: temporal median -> IR amplitude mask -> flying pixel removal
+	depthData.AllocateFiltered();
+
+	std::vector<UINT16> scratch((size_t)numWorkers * numPixels);
+	std::vector<UINT16> maskScratch(infraData.IsCompressed() ? (size_t)numWorkers * numPixels : 1);
+
+	ParallelForFrames(numDepth, numWorkers, [&](int worker, int i) {
+		UINT16 *median = &scratch[(size_t)worker * numPixels];
+
+		const UINT16 *window[FILTER_MAX_MEDIAN_FRAMES];
+		int first;
+		int n = TemporalWindow(i, numDepth, programState.filterMedianFrames, &first);
+		for(int f = 0; f < n; ++f)
+			window[f] = depthWindows[worker].Get(first + f);
+		TemporalMedian(window, n, numPixels, median);
+
+		// Depth and infra come from the same sensor so share RelativeTime
+		int infraIdx = FindNearestFrame(depthData.relTimeArray[i], infraData.relTimeArray, numInfra);
+		if(infraIdx >= 0)
+			MaskDepthByInfra(median, infraData.FilteredFrame(infraIdx, &maskScratch[0] + worker * numPixels)
+				, numPixels, FILTER_MIN_IR_AMPLITUDE, FILTER_MAX_IR_AMPLITUDE);
+
+		UINT16 *filtered = depthData.FilteredTarget(i, &outScratch[(size_t)worker * numPixels]);
+		RemoveFlyingPixels(median, filtered, DEPTH_SIZE.width, DEPTH_SIZE.height
+			, FILTER_FLYING_PIXEL_MM);
+		depthData.StoreFiltered(i, filtered, &codecScratch[0] + worker * codecBytes, frameCompressor);
+	});
+
+	double ms = (getTickCount() - startTicks) * 1000.0 / getTickFrequency();
+	int numFrames = std::max(numDepth, numInfra);
+	ioMutex.lock();
+		cout << "Filtered depth and infra frames: " << numFrames << " in " << ms << "ms";
+		if(ms > 0)
+			cout << " (" << numFrames * 1000.0 / ms << " FPS)";
+		cout << endl;
+	ioMutex.unlock();
 }
 
-void WriteDepth()
+// Prints flagged segments of one stream to out
+template<class Stream>
+void PrintFlaggedSegments(std::ostream &out, const StreamBuffers<Stream> &data)
 {
-	std::string DUMP_PATH = programState.dumpPath;
+	if(!data.statsArray)
+		return;
 
-	ofstream out(DUMP_PATH + "depth_times.txt");
-	if(out.bad()) {
-		cerr << "Problem opening depth_times.txt" << endl;
-		exit(EXIT_FAILURE);
+	std::vector<FlaggedSegment> segments = FindFlaggedSegments(data.statsArray, data.framesCaptured
+		, ANALYTICS_SEGMENT_GAP_FRAMES);
+	out << Stream::Name() << ": " << segments.size() << " flagged segments" << endl;
+	for(size_t s = 0; s < segments.size(); ++s)
+	{
+		const FlaggedSegment &seg = segments[s];
+		out << "  frames " << seg.firstFrame << "-" << seg.lastFrame
+			<< "  ms " << data.relTimeArray[seg.firstFrame] / TICKS_TO_MS 
+			<< "-" << data.relTimeArray[seg.lastFrame] / TICKS_TO_MS
+			<< "  flagged " << seg.numFlagged
+			<< "  " << FrameFlagsToString(seg.flags) << endl;
 	}
-	out << "frame_idx" << "\t" << "RelativeTime" << endl;
-
-	int i;
-	for(i = 0; i < DEPTH_FRAMES_CAPTURED; ++i)
-	{	
-		// Not dumping extra frames without corresponding images at the end
-		if(depthImageArray[i] == 0)
-			break;
+}
 
-		// Generating numbered filename and dumping images to disk
-		stringstream depthFilename;
-		depthFilename << DUMP_PATH << "depth"; 
-		depthFilename.width(8);
-		depthFilename.fill('0');
-		depthFilename << i;
-		depthFilename << ".tiff";
+template<class Stream>
+void PrintAnalyticsTime(const StreamBuffers<Stream> &data)
+{
+	if(!data.statsArray)
+		return;
+	cout << Stream::Name() << " analytics: " << data.analyzer.AverageMs() << "ms avg, " 
+		<< data.analyzer.MaxMs() << "ms max per frame" << endl;
+}
 
-		if(programState.isVerbose)
-			cout << "Writing: " << depthFilename.str() << endl;
+// <prefix>_quality.txt in the dump directory
+template<class Stream>
+void WriteFrameStats(const StreamBuffers<Stream> &data)
+{
+	if(!data.statsArray)
+		return;
+	ofstream out(programState.dumpPath + Stream::FilePrefix() + "_quality.txt");
+	WriteFrameStats(out, data.statsArray, data.relTimeArray, data.framesCaptured);
+}
 
-		imwrite(depthFilename.str().c_str(), *depthImageArray[i]);
-		out << i << "\t" << depthRelTimeArray[i] << endl;		
-	}
+// Session quality summary (-a), printed right after capture
+void PrintQualitySummary()
+{
 	ioMutex.lock();
-		//cout << "WriteDepth Thread DONE!!" << endl;
-		//cout << "Depth Frames written to " << DUMP_PATH << endl;
-		cout << "Depth Frames written: " << i << endl;
+		PrintAnalyticsTime(depthData);
+		PrintAnalyticsTime(infraData);
+		PrintAnalyticsTime(longInfraData);
+		PrintFlaggedSegments(cout, depthData);
+		PrintFlaggedSegments(cout, infraData);
+		PrintFlaggedSegments(cout, longInfraData);
 	ioMutex.unlock();
+}
 
+// Per-frame quality tables and the flagged segment list, written to the dump directory
+void WriteQualityReport()
+{
+	WriteFrameStats(depthData);
+	WriteFrameStats(infraData);
+	WriteFrameStats(longInfraData);
+
+	ofstream report(programState.dumpPath + "quality_report.txt");
+	if(report.bad()) {
+		cerr << "Problem opening quality_report.txt" << endl;
+		return;
+	}
+	PrintFlaggedSegments(report, depthData);
+	PrintFlaggedSegments(report, infraData);
+	PrintFlaggedSegments(report, longInfraData);
+}
+
+// Biggest file the dump writes with the current options, which sizes the I/O scheduler's buffers.
+// Tiffs at their worst case, as LZW can make a noisy tiff bigger than its pixels (see TiffMaxBytes())
+size_t LargestDumpFileBytes()
+{
+	size_t bytes = TiffMaxBytes(DEPTH_SIZE.width, DEPTH_SIZE.height, 3);	// rgbMapped
+	if(programState.isSaveYUY2)
+		bytes = std::max(bytes, (size_t)COLOR_SIZE.area() * COLOR_DEPTH);
+	if(programState.isSaveUnmapped)
+		bytes = std::max(bytes, TiffMaxBytes(COLOR_SIZE.width, COLOR_SIZE.height, 3));
+	if(programState.isRegisterDepth)
+		bytes = std::max(bytes, TiffMaxBytes(COLOR_SIZE.width, COLOR_SIZE.height, 2));
+	return bytes;
 }
 
-void WriteInfra()
+// Dumps the frames of one stream in RAM to HDD, with <prefix>_times.txt holding time stamps.
+// Frame format comes from the stream's Encoder (see streams.h)
+template<class Stream>
+void WriteStream(StreamBuffers<Stream> *data)
 {
 	std::string DUMP_PATH = programState.dumpPath;
+	std::string timesFilename = std::string(Stream::FilePrefix()) + "_times.txt";
 
-	ofstream out(DUMP_PATH + "infra_times.txt");
+	ofstream out(DUMP_PATH + timesFilename);
 	if(out.bad()) {
-		cerr << "Problem opening infra_times.txt" << endl;
+		cerr << "Problem opening " << timesFilename << endl;
 		exit(EXIT_FAILURE);
 	}
 	out << "frame_idx" << "\t" << "RelativeTime" << endl;
 
-	int i;
-	for(i = 0; i < INFRA_FRAMES_CAPTURED; ++i)
-	{
-		
-		// Not dumping extra frames without corresponding images at the end
-		if(infraImageArray[i] == 0)
-			break;
+	typename Stream::Encoder encoder(DUMP_PATH, programState.isVerbose, &ioScheduler);
+	std::string prefix = Stream::FilePrefix();
+	std::string filteredPrefix = prefix + "Filtered";
 
-		// Generating numbered filename and dumping images to disk
-		stringstream infraFilename;
-		infraFilename << DUMP_PATH << "infra"; 
-		infraFilename.width(8);
-		infraFilename.fill('0');
-		infraFilename << i;
-		infraFilename << ".tiff";
+	// Decompressed frame (-c)
+	std::vector<typename Stream::Pixel> scratch(data->IsCompressed() ? data->ElementsPerFrame() : 1);
 
-		if(programState.isVerbose)
-			cout << "Writing: " << infraFilename.str() << endl;
-		
-		imwrite(infraFilename.str().c_str(), *infraImageArray[i]);
-		out << i << "\t" << infraRelTimeArray[i] << endl;
+	int i;
+	for(i = 0; i < data->framesCaptured; ++i)
+	{	
+		encoder.Encode(prefix, i, data->Frame(i, &scratch[0]), data->relTimeArray[i]);
+		out << i << "\t" << data->relTimeArray[i] << endl;		
 
+		if(data->HasFiltered())
+			encoder.Encode(filteredPrefix, i, data->FilteredFrame(i, &scratch[0]), data->relTimeArray[i]);
 	}
 	ioMutex.lock();
-		//cout << "WriteInfra Thread DONE!!" << endl;
-		//cout << "Infra Frames written to " << DUMP_PATH << endl;
-		cout << "Infra Frames written: " << i << endl;
+		cout << Stream::Name() << " Frames written: " << i << endl;
 	ioMutex.unlock();
 }
 
-void WriteColor()
+// Keeps an eye on the compressed store while capturing (-c). Once frames have been measured it
+// re-estimates the RAM needed with the real compression ratio, and ends the capture before RAM runs out.
+void WatchCompressedCapture(float ramEstimate, float ramAvailable)
 {
-	std::string DUMP_PATH = programState.dumpPath;
+	const float secondsRequested = (float)programState.maxFramesToCapture / NUM_FRAMES_PER_SECOND;
+	bool isReported = false;
 
-	ofstream out(DUMP_PATH + "color_times.txt");
-	if(out.bad()) {
-		cerr << "Problem opening color_times.txt" << endl;
-		exit(EXIT_FAILURE);
+	while(!CAPTURE_DONE)
+	{
+		Sleep(COMPRESS_WATCH_MS);
+		double ratio = frameCompressor.Ratio();
+		if(ratio <= 0)
+			continue;
+
+		if(!isReported) {
+			float rawMBPerSecond = ramEstimate / secondsRequested;
+			ioMutex.lock();
+				cout << "Measured compression ratio: " << ratio << ":1" << endl;
+				cout << "RAM REQUIRED: " << ramEstimate / ratio << "MB (Estimate from measured ratio)" << endl;
+				cout << "RAM AVAILABLE fits about " << ramAvailable / RAM_PADDING_RATIO / (rawMBPerSecond / ratio)
+					<< "s of capture at this ratio" << endl;
+			ioMutex.unlock();
+			isReported = true;
+		}
+
+		UINT64 usedBytes = frameCompressor.arena.BytesReserved() + depthData.rawSlots.BytesAllocated() 
+			+ infraData.rawSlots.BytesAllocated() + colorData.rawSlots.BytesAllocated()
+			+ bodyIndexData.rawSlots.BytesAllocated() + longInfraData.rawSlots.BytesAllocated();
+		float usedMB = (float)usedBytes / 1024 / 1024;
+		if(usedMB * RAM_PADDING_RATIO > ramAvailable) {
+			ioMutex.lock();
+				cerr << "!!! Compressed store is running out of RAM, stopping capture !!!" << endl;
+			ioMutex.unlock();
+			CAPTURE_DONE = true;
+		}
 	}
-	out << "frame_idx" << "\t" << "RelativeTime" << endl;
+}
 
-	BYTE *grayBuf = new BYTE[COLOR_SIZE.area()];	// Y channel data of YUY2
-	BYTE *rgbBuf = new BYTE[COLOR_SIZE.area() * 3];
-	ColorSpacePoint *depthInColorSpace = new ColorSpacePoint[DEPTH_SIZE.area()];
-	BYTE *grayBufMapped = new BYTE[DEPTH_SIZE.area()];
-	BYTE *rgbBufMapped = new BYTE[DEPTH_SIZE.area()*3];
+// Compressed store stats (-c), printed after capture
+void PrintCompressionSummary()
+{
+	int grown = depthData.rawSlots.Grown() + infraData.rawSlots.Grown() + colorData.rawSlots.Grown()
+		+ bodyIndexData.rawSlots.Grown() + longInfraData.rawSlots.Grown();
+	int dropped = depthData.rawSlots.Dropped() + infraData.rawSlots.Dropped() + colorData.rawSlots.Dropped()
+		+ bodyIndexData.rawSlots.Dropped() + longInfraData.rawSlots.Dropped();
 
-	int i;
-	for(i = 0; i < COLOR_FRAMES_CAPTURED; ++i)
-	{
-		if(colorBufArray[i] == 0)
-			break;
+	ioMutex.lock();
+		cout << "Compressed store: " << frameCompressor.CompressedBytes() / 1024 / 1024 << "MB for " 
+			<< frameCompressor.RawBytes() / 1024 / 1024 << "MB of frames (" << frameCompressor.Ratio() << ":1), "
+			<< frameCompressor.arena.BytesReserved() / 1024 / 1024 << "MB reserved" << endl;
+		cout << "Compression: " << frameCompressor.BusyMs() << "ms worker time, peak queue " 
+			<< frameCompressor.PeakQueued() << " frames, raw slots added " << grown << endl;
+		if(dropped > 0)
+			cerr << "!!! " << dropped << " frames dropped because compression fell " << COMPRESS_MAX_RAW_SLOTS 
+				<< " frames behind !!!" << endl;
+	ioMutex.unlock();
+}
 
-		if(programState.isSaveYUY2) {
-			// Dumping YUY2 raw color to files
-			stringstream colorFilename;
-			colorFilename << DUMP_PATH << "yuyv"; 
-			colorFilename.width(8);
-			colorFilename.fill('0');
-			colorFilename << i;
-			colorFilename << ".yuv";
-
-			if(programState.isVerbose)
-				cout << "Writing: " << colorFilename.str() << endl;
-			FILE* colorFile;
-			colorFile = fopen(colorFilename.str().c_str(), "wb");
-			fwrite(colorBufArray[i], COLOR_SIZE.area(), COLOR_DEPTH, colorFile);
-			fclose(colorFile);
-		}
-
-		// Filling grayBuf with Y channel
-		// Needed for unmapped 1080p image and depth space mapped image
-		BYTE* cBuf = colorBufArray[i];
-		for(int x = 0; x < COLOR_SIZE.area(); ++x)
-		{
-			grayBuf[x] = cBuf[2*x];
-		}
-		Mat gray(COLOR_SIZE, CV_8UC1, grayBuf, Mat::AUTO_STEP);
+// ---- Soak test (--soakTest) ----
+// Runs capture -> store -> filter -> dump on synthetic frames at multiples of the sensor frame
+// rate, with the same switches as a real capture (-c, -f, -a, -l, -g, -u, -y, -d), to find out
+// whether a machine keeps up before it is used for real.
 
-		if(programState.isSaveGray && programState.isSaveUnmapped) {
-			// Using OpenCV Mat header to wrap and save
-			stringstream grayFilename;
-			grayFilename << DUMP_PATH << "gray"; 
-			grayFilename.width(8);
-			grayFilename.fill('0');
-			grayFilename << i;
-			grayFilename << ".tiff";
-
-			if(programState.isVerbose)
-				cout << "Writing: " << grayFilename.str() << endl;		
-			imwrite(grayFilename.str().c_str(), gray);		
-		}
-
-		// TODO if we only need the depth space mapped RGB, doing 1920x1080 samples is very slow and wasteful
-		// YUY2 to RGB according to:
-		// http://stackoverflow.com/questions/4491649/how-to-convert-yuy2-to-a-bitmap-in-c
-		// Needed for unmapped 1080p image and depth space mapped image
-		BYTE *ptrIn = colorBufArray[i];
-		BYTE *ptrOut = rgbBuf;
-		for (int j = 0;  j < COLOR_SIZE.area()/2;  ++j)
-		{
-			int y0 = ptrIn[0];
-			int u0 = ptrIn[1];
-			int y1 = ptrIn[2];
-			int v0 = ptrIn[3];
-			ptrIn += 4;
-			int c = y0 - 16;
-			int d = u0 - 128;
-			int e = v0 - 128;
-			ptrOut[0] = saturate_cast<uchar>(( 298 * c + 516 * d + 128) >> 8); // blue
-			ptrOut[1] = saturate_cast<uchar>(( 298 * c - 100 * d - 208 * e + 128) >> 8); // green
-			ptrOut[2] = saturate_cast<uchar>(( 298 * c + 409 * e + 128) >> 8); // red
-			c = y1 - 16;
-			ptrOut[3] = saturate_cast<uchar>(( 298 * c + 516 * d + 128) >> 8); // blue
-			ptrOut[4] = saturate_cast<uchar>(( 298 * c - 100 * d - 208 * e + 128) >> 8); // green
-			ptrOut[5] = saturate_cast<uchar>(( 298 * c + 409 * e + 128) >> 8); // red
-			ptrOut += 6;
-		}
-		Mat rgb(COLOR_SIZE, CV_8UC3, rgbBuf, Mat::AUTO_STEP);
+static const int SOAK_RATES[] = { 1, 2, 4 };				// x 30 FPS
+static const int SOAK_MAX_DROPPED_FRAMES = 0;
+static const double SOAK_MAX_P99_LATENCY_PERIODS = 0.5;	// p99 capture latency, in frame periods
+static const double SOAK_MAX_STORE_LAG_SEC = 1.0;		// Compression backlog left when capture ends (-c)
+static const double SOAK_MAX_DUMP_SLOWDOWN = 10.0;		// Dump time / capture time
+static const DWORD SOAK_RSS_SAMPLE_MS = 50;				// Working set sampling period
 
-		if(programState.isSaveUnmapped) {
-			stringstream rgbFilename;
-			rgbFilename << DUMP_PATH << "rgb"; 
-			rgbFilename.width(8);
-			rgbFilename.fill('0');
-			rgbFilename << i;
-			rgbFilename << ".tiff";
+// One rate of the soak test, shared by its capture threads
+struct SoakRun
+{
+	const SyntheticSource *source;
+	double fps;
+	int numFrames;
+	INT64 startTicks;
+};
 
-			if(programState.isVerbose)
-				cout << "Writing: " << rgbFilename.str() << endl;		
-			imwrite(rgbFilename.str().c_str(), rgb);	
-		}
+struct SoakStreamResult
+{
+	int frames;
+	int dropped;
+	std::vector<double> latencyUs;	// Frame due -> stored (committed to the arena with -c)
+};
+
+// Synthetic frame k of each stream the soak test drives
+inline const UINT16* SyntheticFrame(const SyntheticSource &source, int k, DepthStream*) { return source.Depth(k); }
+inline const UINT16* SyntheticFrame(const SyntheticSource &source, int k, InfraStream*) { return source.Infra(k); }
+inline const BYTE* SyntheticFrame(const SyntheticSource &source, int k, ColorStream*) { return source.Color(k); }
+
+// Stand-in for ProcessStream(): the synthetic "sensor" makes frame k due at k / fps. 
+// Like the real sensor, a frame not picked up before the next one is due is lost.
+template<class Stream>
+void SoakCaptureStream(StreamBuffers<Stream> *data, const SoakRun *run, SoakStreamResult *result)
+{
+	const double fps = run->fps;
+	const int numFrames = run->numFrames;
+	const INT64 startTicks = run->startTicks;
 
-		// REMAP TO DEPTH SPACE
-		// TODO speed up with LUT?
-		// TODO dump depth coords?
-		// TODO can speed this up if we guess 15FPS etc
+	result->latencyUs.reserve(numFrames);
+	result->dropped = 0;
 
-		// Finding nearest depthBuffer in terms of Relative Time
-		int lastDepthIdx = DEPTH_FRAMES_CAPTURED-1;
-		for(int j = 0; j < DEPTH_FRAMES_CAPTURED; ++j)
-		{
-			if(colorRelTimeArray[i] < depthRelTimeArray[j]) {
-				lastDepthIdx = j-1;
-				break;
-			}
+	int i = 0;
+	for(int k = 0; k < numFrames; ++k)
+	{
+		PaceFrame(startTicks, k, fps);
+
+		int due = std::min(numFrames - 1, (int)(TicksToUs(NowTicks() - startTicks) * fps / 1000000.0));
+		if(due > k) {
+			result->dropped += due - k;
+			k = due;
 		}
 
-		// TODO temporary fix. Needs better solution e.g finding nearest depth or assuming zeros for Depth
-		if(lastDepthIdx < 0) lastDepthIdx = 0;
+		typename Stream::Pixel *buf = data->CaptureBuffer(i);
+		if(!buf) {
+			++result->dropped;	// Compression too far behind (-c)
+			continue;
+		}
+		memcpy(buf, SyntheticFrame(*run->source, k, (Stream*)NULL), data->BytesPerFrame());
+		data->relTimeArray[i] = SyntheticSource::RelativeTime(k);
+
+		if(data->statsArray)
+			Stream::Analyze(data->analyzer, buf, data->statsArray + i);
+		if(data->ring.IsOpen())
+			data->ring.Publish(buf, data->BytesPerFrame(), data->relTimeArray[i]);
+		data->Store(i, buf, frameCompressor);
+
+		// With -c the frame is only submitted here, see SoakCompressedLatency()
+		if(!data->IsCompressed())
+			result->latencyUs.push_back(TicksToUs(NowTicks() - startTicks) - k * 1000000.0 / fps);
+		++i;
+	}
+	data->framesCaptured = i;
+	result->frames = i;
+}
 
-		UINT16 *depthBuf = depthBufArray[lastDepthIdx];
-		if(depthBuf) {
-			HRESULT hr = coordMapper->MapDepthFrameToColorSpace(DEPTH_SIZE.area(), depthBuf
-				, DEPTH_SIZE.area(), depthInColorSpace);
-			if(FAILED(hr)) {
-				std::cerr << "COLOR MAPPING FAILED!!" << endl;
-				std::cerr << (unsigned long)hr << endl;
-				exit(EXIT_FAILURE);	
-			}
+// With -c a frame is stored once a worker has committed it to the arena. Only after frameCompressor.Finish()
+template<class Stream>
+void SoakCompressedLatency(const StreamBuffers<Stream> *data, const SoakRun *run, SoakStreamResult *result)
+{
+	for(int i = 0; i < data->framesCaptured; ++i)
+	{
+		INT64 k = data->relTimeArray[i] / SYNTHETIC_FRAME_TICKS;
+		result->latencyUs.push_back(TicksToUs(data->compressedArray[i].storedTicks - run->startTicks) - k * 1000000.0 / run->fps);
+	}
+}
+
+static double MBPerSec(double bytes, double seconds)
+{
+	return seconds > 0 ? bytes / 1024 / 1024 / seconds : 0.0;
+}
 
-			if(programState.isSaveGray) {
-				memset(grayBufMapped, 0, sizeof(BYTE)*DEPTH_SIZE.area());
-				for(int j = 0; j < DEPTH_SIZE.area(); ++j)
-				{
-					int x = round(depthInColorSpace[j].X);
-					int y = round(depthInColorSpace[j].Y);
+// Prints one budget check and returns isOk
+static bool SoakCheck(const char *what, bool isOk)
+{
+	cout << "  " << (isOk ? "PASS " : "FAIL ") << what << endl;
+	return isOk;
+}
 
-					if(x >= 0 && x < COLOR_SIZE.width && y >=0 && y < COLOR_SIZE.height) {
-						grayBufMapped[j] = gray.at<BYTE>(y, x);					
-					}
-				}
-				Mat grayMapped = Mat(DEPTH_SIZE, CV_8UC1, grayBufMapped, Mat::AUTO_STEP);
-
-				stringstream grayMappedFilename;
-				grayMappedFilename << DUMP_PATH << "grayMapped"; 
-				grayMappedFilename.width(8);
-				grayMappedFilename.fill('0');
-				grayMappedFilename << i;
-				grayMappedFilename << ".tiff";
-
-				if(programState.isVerbose)
-					cout << "Writing: " << grayMappedFilename.str() << endl;		
-				imwrite(grayMappedFilename.str().c_str(), grayMapped);
-			}
+// Returns true if every rate passed
+bool RunSoakTest(int seconds)
+{
+	static const char* labels[3] = { "Depth", "Infra", "Color" };
+
+	SyntheticSource source;
+	const std::string basePath = programState.dumpPath;
+	const std::string soakPath = basePath + "soak/";
+	const double frameSetBytes = (double)StreamBuffers<DepthStream>::BytesPerFrame() 
+		+ StreamBuffers<InfraStream>::BytesPerFrame() + StreamBuffers<ColorStream>::BytesPerFrame();
+
+	cout << "Soak test: " << seconds << "s per rate, depth + infra + color" 
+		<< (programState.isCompress ? ", compressed (-c)" : "") << (programState.isFilter ? ", filtered (-f)" : "")
+		<< (programState.isAnalytics ? ", analytics (-a)" : "") << (programState.isLive ? ", live (-l)" : "") << endl;
+
+	if(!programState.isDryRun) {
+		std::wstring wideStr;
+		wideStr.assign(soakPath.begin(), soakPath.end());
+		if(!CreateDirectory(wideStr.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+			std::cerr << "Unable to Create soak test directory " << soakPath << endl;
+			return false;
+		}
+		cout << "Dumping to " << soakPath << " (each rate overwrites the last)" << endl;
+	}
 
-			memset(rgbBufMapped, 0, sizeof(BYTE)*DEPTH_SIZE.area() * 3);
-			for(int j = 0; j < DEPTH_SIZE.area(); ++j)
+	bool isAllOk = true;
+	for(size_t r = 0; r < sizeof(SOAK_RATES) / sizeof(SOAK_RATES[0]); ++r)
+	{
+		const int rate = SOAK_RATES[r];
+		const double fps = (double)NUM_FRAMES_PER_SECOND * rate;
+		const int numFrames = (int)(seconds * fps);
+		cout << endl << "---- " << rate << "x (" << fps << " FPS, " << numFrames << " frames per stream) ----" << endl;
+
+		// Same RAM check as a real capture, at this rate
+		PERFORMANCE_INFORMATION sysInfo;
+		GetPerformanceInfo(&sysInfo, sizeof(sysInfo));
+		float ramAvailable = (float)sysInfo.PageSize * sysInfo.PhysicalAvailable / 1024 / 1024;
+		float ramEstimate = numFrames * RAM_MB_PER_FRAME_SET;
+		if(programState.isFilter)
+			ramEstimate += numFrames * RAM_MB_PER_FILTERED_SET;
+		if(programState.isCompress)
+			ramEstimate /= COMPRESS_EXPECTED_RATIO;
+		PROCESS_MEMORY_COUNTERS memInfo;
+		GetProcessMemoryInfo(GetCurrentProcess(), &memInfo, sizeof(memInfo));
+		double startRssMB = (double)memInfo.WorkingSetSize / 1024 / 1024;
+		if(ramAvailable < ramEstimate * RAM_PADDING_RATIO) {
+			cout << "  FAIL not enough RAM: " << ramEstimate << "MB needed, " << ramAvailable << "MB available" << endl;
+			isAllOk = false;
+			continue;
+		}
+
+		if(programState.isLive && !(depthData.CreateRing() && infraData.CreateRing() && colorData.CreateRing())) {
+			std::cerr << "Unable to create live rings" << endl;
+			return false;
+		}
+		if(programState.isCompress)
+			frameCompressor.Start(std::max(1, NumWorkerThreads() - 1), StreamBuffers<ColorStream>::MaxCompressedBytes());
+
+		// Working set sampled while this rate runs. PeakWorkingSetSize is over the process
+		// lifetime, so from the second rate on it would only show the earlier rates' peak
+		std::atomic<bool> isRateDone(false);
+		SIZE_T peakRssBytes = memInfo.WorkingSetSize;
+		thread rssSampler([&]() {
+			PROCESS_MEMORY_COUNTERS sample;
+			while(!isRateDone)
 			{
-				int x = round(depthInColorSpace[j].X);
-				int y = round(depthInColorSpace[j].Y);
-
-				if(x >= 0 && x < COLOR_SIZE.width && y >=0 && y < COLOR_SIZE.height) {
-					// TODO speed up
-					Vec3b bgrPixel = rgb.at<Vec3b>(y, x);
-					rgbBufMapped[3*j] = bgrPixel[0];
-					rgbBufMapped[3*j+1] = bgrPixel[1];
-					rgbBufMapped[3*j+2] = bgrPixel[2];
-				}
+				GetProcessMemoryInfo(GetCurrentProcess(), &sample, sizeof(sample));
+				peakRssBytes = std::max(peakRssBytes, sample.WorkingSetSize);
+				Sleep(SOAK_RSS_SAMPLE_MS);
 			}
-			Mat rgbMapped =  Mat(DEPTH_SIZE, CV_8UC3, rgbBufMapped, Mat::AUTO_STEP);
+		});
+
+		// Allocated before the clock starts, like OpenStream() does, so allocating isn't timed as capture
+		depthData.Allocate(numFrames, programState.isAnalytics, programState.isCompress);
+		infraData.Allocate(numFrames, programState.isAnalytics, programState.isCompress);
+		colorData.Allocate(numFrames, programState.isAnalytics, programState.isCompress);
+
+		// Capture -> store
+		SoakStreamResult results[3];
+		SoakRun run;
+		run.source = &source;
+		run.fps = fps;
+		run.numFrames = numFrames;
+		run.startTicks = NowTicks();
+		const INT64 startTicks = run.startTicks;
+		std::vector<thread> procThreads;
+		procThreads.push_back(thread(&SoakCaptureStream<DepthStream>, &depthData, &run, results + 0));
+		procThreads.push_back(thread(&SoakCaptureStream<InfraStream>, &infraData, &run, results + 1));
+		procThreads.push_back(thread(&SoakCaptureStream<ColorStream>, &colorData, &run, results + 2));
+		for(size_t t = 0; t < procThreads.size(); ++t)
+			procThreads[t].join();
+		double captureSec = TicksToUs(NowTicks() - startTicks) / 1000000;
+
+		int slotsAdded = depthData.rawSlots.Grown() + infraData.rawSlots.Grown() + colorData.rawSlots.Grown();
+		double storeLagSec = 0;
+		if(programState.isCompress) {
+			INT64 drainTicks = NowTicks();
+			frameCompressor.Finish();
+			storeLagSec = TicksToUs(NowTicks() - drainTicks) / 1000000;
+			SoakCompressedLatency(&depthData, &run, results + 0);
+			SoakCompressedLatency(&infraData, &run, results + 1);
+			SoakCompressedLatency(&colorData, &run, results + 2);
+		}
+		double storeSec = captureSec + storeLagSec;
+		depthData.rawSlots.Free();
+		infraData.rawSlots.Free();
+		colorData.rawSlots.Free();
+		depthData.ring.Close();
+		infraData.ring.Close();
+		colorData.ring.Close();
+
+		double capturedBytes = 0;
+		int dropped = 0;
+		for(int s = 0; s < 3; ++s)
+			dropped += results[s].dropped;
+		capturedBytes += (double)results[0].frames * StreamBuffers<DepthStream>::BytesPerFrame();
+		capturedBytes += (double)results[1].frames * StreamBuffers<InfraStream>::BytesPerFrame();
+		capturedBytes += (double)results[2].frames * StreamBuffers<ColorStream>::BytesPerFrame();
+
+		// Filter
+		double filterSec = 0;
+		if(programState.isFilter) {
+			INT64 t0 = NowTicks();
+			FilterDepthInfra();
+			filterSec = TicksToUs(NowTicks() - t0) / 1000000;
+		}
 
-			stringstream rgbMappedFilename;
-			rgbMappedFilename << DUMP_PATH << "rgbMapped"; 
-			rgbMappedFilename.width(8);
-			rgbMappedFilename.fill('0');
-			rgbMappedFilename << i;
-			rgbMappedFilename << ".tiff";
+		// Dump
+		double dumpSec = 0;
+		if(!programState.isDryRun) {
+			programState.dumpPath = soakPath;
+			INT64 t0 = NowTicks();
+			ioScheduler.Start(false, LargestDumpFileBytes());
+			std::vector<thread> writeThreads;
+			writeThreads.push_back(thread(&WriteStream<DepthStream>, &depthData));
+			writeThreads.push_back(thread(&WriteStream<InfraStream>, &infraData));
+			writeThreads.push_back(thread(&WriteStream<ColorStream>, &colorData));
+			for(size_t t = 0; t < writeThreads.size(); ++t)
+				writeThreads[t].join();
+			if(programState.isRegisterDepth)
+				WriteRegisteredDepth();
+			ioScheduler.Finish();
+			dumpSec = TicksToUs(NowTicks() - t0) / 1000000;
+			programState.dumpPath = basePath;
+		}
 
-			if(programState.isVerbose)
-				cout << "Writing: " << rgbMappedFilename.str() << endl;		
-			imwrite(rgbMappedFilename.str().c_str(), rgbMapped);
+		isRateDone = true;
+		rssSampler.join();
+		GetProcessMemoryInfo(GetCurrentProcess(), &memInfo, sizeof(memInfo));
+		double peakRssMB = (double)std::max(peakRssBytes, memInfo.WorkingSetSize) / 1024 / 1024;
+
+		// Report
+		cout << "Throughput (MB/s of raw frame data, sensor rate " << MBPerSec(frameSetBytes * fps, 1.0) << ")" << endl;
+		cout << "  capture " << MBPerSec(capturedBytes, captureSec) << endl;
+		if(programState.isCompress)
+			cout << "  store   " << MBPerSec((double)frameCompressor.RawBytes(), storeSec) << "  (ratio " 
+				<< frameCompressor.Ratio() << ":1, " << MBPerSec((double)frameCompressor.RawBytes(), frameCompressor.BusyMs() / 1000)
+				<< " per worker, backlog " << storeLagSec << "s, raw slots added " << slotsAdded << ")" << endl;
+		if(programState.isFilter)
+			cout << "  filter  " << MBPerSec((double)depthData.framesCaptured * depthData.BytesPerFrame() 
+				+ (double)infraData.framesCaptured * infraData.BytesPerFrame(), filterSec) << endl;
+		if(!programState.isDryRun)
+			cout << "  dump    " << MBPerSec(capturedBytes, dumpSec) << "  (" << dumpSec << "s)" << endl;
+		cout << "Peak RSS " << peakRssMB << "MB" << endl;
+
+		double worstP99Periods = 0;
+		for(int s = 0; s < 3; ++s)
+		{
+			SoakStreamResult &res = results[s];
+			double p99 = Percentile(res.latencyUs, 99);
+			worstP99Periods = std::max(worstP99Periods, p99 * fps / 1000000.0);
+			cout << labels[s] << ": " << res.frames << " frames, " << res.dropped << " dropped, latency us  p50 " 
+				<< Percentile(res.latencyUs, 50) << "  p99 " << p99 << "  p99.9 " << Percentile(res.latencyUs, 99.9)
+				<< "  max " << Percentile(res.latencyUs, 100) << endl;
 		}
 
-		// Timestamp
-		out << i << "\t" << colorRelTimeArray[i] << endl;
+		bool isOk = SoakCheck("dropped frames", dropped <= SOAK_MAX_DROPPED_FRAMES);
+		isOk = SoakCheck("p99 capture latency", worstP99Periods <= SOAK_MAX_P99_LATENCY_PERIODS) && isOk;
+		if(programState.isCompress)
+			isOk = SoakCheck("compression keeps up", storeLagSec <= SOAK_MAX_STORE_LAG_SEC) && isOk;
+		isOk = SoakCheck("peak RSS fits in RAM", (peakRssMB - startRssMB) * RAM_PADDING_RATIO <= ramAvailable) && isOk;
+		if(!programState.isDryRun)
+			isOk = SoakCheck("dump speed", dumpSec <= captureSec * SOAK_MAX_DUMP_SLOWDOWN) && isOk;
+		cout << rate << "x " << (isOk ? "PASSED" : "FAILED") << endl;
+		isAllOk = isAllOk && isOk;
+
+		depthData.Free();
+		infraData.Free();
+		colorData.Free();
+		frameCompressor.Clear();
 	}
 
-	// Cleaning up
-	if(grayBuf) delete [] grayBuf;
-	if(depthInColorSpace) delete [] depthInColorSpace;
-
-	ioMutex.lock();
-		//cout << "WriteColorThread DONE!!" << endl;
-		//cout << "Color Frames written to " << DUMP_PATH << endl;
-		cout << "Color Frames written: " << i << endl;
-	ioMutex.unlock();
+	cout << endl << "SOAK TEST " << (isAllOk ? "PASSED" : "FAILED") << endl;
+	return isAllOk;
 }
 
 int main(int argc, char** argv)
 {
 	HRESULT hr;
 
-	hr = GetDefaultKinectSensor(&kinect);
-	if(FAILED(hr)) exit(EXIT_FAILURE);
-	
-	hr = kinect->Open();
-	if(FAILED(hr)) exit(EXIT_FAILURE);
-
-	// Getting coordinate mapper
-	hr = kinect->get_CoordinateMapper(&coordMapper);
-	if(FAILED(hr)) exit(EXIT_FAILURE);
-
 	// Parsing command line arguments
 	try {
 		TCLAP::CmdLine cmd("Usage: dumpK4W.exe [-s savepath] [-n num_sec_to_cap] [-d:DRYRUN]", ' ', "0.1");
@@ -777,6 +1436,82 @@ int main(int argc, char** argv)
 			, "Saves original 1920x1080 images no in depth space (color images, and gray also if enabled via -g)"
 			, cmd, false);
 
+		TCLAP::SwitchArg bodyIndexSwitch("b", "bodyIndex"
+			, "Also captures the BodyIndex stream (saved as 8 bit bodyIndex images)"
+			, cmd, false);
+
+		TCLAP::SwitchArg longInfraSwitch("e", "longExposureInfra"
+			, "Also captures the LongExposureInfrared stream (saved as 16 bit longInfra images)"
+			, cmd, false);
+
+		TCLAP::SwitchArg filterSwitch("f", "filter"
+			, "Also saves depth and infra cleaned of flying pixels, low/saturated IR and flashing (temporal median)"
+			, cmd, false);
+
+		TCLAP::SwitchArg analyticsSwitch("a", "analytics"
+			, "Computes per-frame depth/IR quality stats during capture and reports flagged (flashing) segments"
+			, cmd, false);
+
+		TCLAP::SwitchArg liveSwitch("l", "live"
+			, "Publishes frames to shared memory as they arrive so other local programs can read them live"
+			, cmd, false);
+
+		TCLAP::SwitchArg compressSwitch("c", "compress"
+			, "Keeps frames losslessly compressed in RAM so longer captures fit. Uses background CPU"
+			, cmd, false);
+
+		TCLAP::SwitchArg reactorSwitch("r", "reactor"
+			, "Captures all streams from one reactor thread in arrival order instead of one thread per stream"
+			, cmd, false);
+
+		TCLAP::SwitchArg registerDepthSwitch("z", "registerDepth"
+			, "Also dumps depth registered into 1920x1080 color space for every color frame (depthRegistered*.tiff)"
+			, cmd, false);
+
+		TCLAP::SwitchArg registerBilinearSwitch("", "registerBilinear"
+			, "Smoother -z output: bilinear splatting of depth pixels instead of nearest"
+			, cmd, false);
+
+		TCLAP::ValueArg<int> reactorBenchArg("", "reactorBench"
+			, "Compares wakeups and latency of thread per stream and reactor capture on synthetic frames for this many seconds"
+			" each. No Kinect needed"
+			, false, 0, "INT");
+		cmd.add(reactorBenchArg);
+
+		TCLAP::ValueArg<int> ioBenchArg("", "ioBench"
+			, "Writes this many seconds of synthetic dump files to dumpPath/iobench with one writer per stream, then"
+			" through the I/O scheduler, and compares both to one sequential file. No Kinect needed"
+			, false, 0, "INT");
+		cmd.add(ioBenchArg);
+
+		TCLAP::ValueArg<int> readerBenchArg("", "readerBench"
+			, "Writes this many seconds of synthetic yuyv frames to dumpPath/readerbench and times scrubbing through"
+			" them with the dump reader. No Kinect needed"
+			, false, 0, "INT");
+		cmd.add(readerBenchArg);
+
+		TCLAP::ValueArg<int> colorBenchArg("", "colorBench"
+			, "Times making grayMapped and rgbMapped from synthetic color frames with the old full frame conversion and"
+			" with the fused sampler for this many seconds each, and checks they match. No Kinect needed"
+			, false, 0, "INT");
+		cmd.add(colorBenchArg);
+
+		TCLAP::ValueArg<int> liveLatencyTestArg("", "liveLatencyTest"
+			, "Runs the live publishing latency benchmark on synthetic frames for this many seconds. No Kinect needed"
+			, false, 0, "INT");
+		cmd.add(liveLatencyTestArg);
+
+		TCLAP::ValueArg<int> soakTestArg("", "soakTest"
+			, "Runs capture, store and dump on synthetic frames at 1x, 2x and 4x the sensor rate for this many seconds each"
+			" and checks the machine keeps up. Honours -c -f -a -l -d -g -u -y -z. No Kinect needed"
+			, false, 0, "INT");
+		cmd.add(soakTestArg);
+
+		TCLAP::ValueArg<int> filterFramesArg("m", "medianFrames"
+			, "Number of frames in the temporal median used by -f (odd, 1 to 9)"
+			, false, FILTER_DEFAULT_MEDIAN_FRAMES, "INT");
+		cmd.add(filterFramesArg);
+
 		// Getting values from command line
 		cmd.parse(argc, argv);
 
@@ -788,6 +1523,33 @@ int main(int argc, char** argv)
 		programState.isSaveGray = saveGraySwitch.getValue();
 		programState.isSaveYUY2 = saveYUY2Switch.getValue();
 		programState.isSaveUnmapped = saveUnmappedSwitch.getValue();
+		programState.isFilter = filterSwitch.getValue();
+
+		depthData.isEnabled = true;
+		infraData.isEnabled = true;
+		colorData.isEnabled = true;
+		bodyIndexData.isEnabled = bodyIndexSwitch.getValue();
+		longInfraData.isEnabled = longInfraSwitch.getValue();
+		programState.filterMedianFrames = filterFramesArg.getValue();
+		programState.isAnalytics = analyticsSwitch.getValue();
+		programState.isLive = liveSwitch.getValue();
+		programState.isCompress = compressSwitch.getValue();
+		programState.isReactor = reactorSwitch.getValue();
+		programState.isRegisterDepth = registerDepthSwitch.getValue() || registerBilinearSwitch.getValue();
+		programState.isRegisterBilinear = registerBilinearSwitch.getValue();
+		programState.reactorBenchSec = reactorBenchArg.getValue();
+		programState.ioBenchSec = ioBenchArg.getValue();
+		programState.readerBenchSec = readerBenchArg.getValue();
+		programState.colorBenchSec = colorBenchArg.getValue();
+		programState.liveLatencyTestSec = liveLatencyTestArg.getValue();
+		programState.soakTestSec = soakTestArg.getValue();
+
+		if(programState.filterMedianFrames < 1 || programState.filterMedianFrames > FILTER_MAX_MEDIAN_FRAMES
+			|| programState.filterMedianFrames % 2 == 0) {
+			std::cerr << "Command line error: medianFrames must be odd and between 1 and " 
+				<< FILTER_MAX_MEDIAN_FRAMES << endl;
+			exit(EXIT_FAILURE);
+		}
 	}
 
 	catch (TCLAP::ArgException &e) {
@@ -795,6 +1557,32 @@ int main(int argc, char** argv)
 		exit(EXIT_FAILURE);
 	}
 
+	// Synthetic source benchmarks. No Kinect needed
+	if(programState.liveLatencyTestSec > 0)
+		return RunLiveLatencyBenchmark(programState.liveLatencyTestSec, LIVE_LATENCY_TEST_READERS) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if(programState.reactorBenchSec > 0) {
+		RunReactorBenchmark(programState.reactorBenchSec);
+		return EXIT_SUCCESS;
+	}
+	if(programState.ioBenchSec > 0)
+		return RunIoBenchmark(programState.ioBenchSec, programState.dumpPath + "iobench/") ? EXIT_SUCCESS : EXIT_FAILURE;
+	if(programState.readerBenchSec > 0)
+		return RunReaderBenchmark(programState.readerBenchSec, programState.dumpPath + "readerbench/") ? EXIT_SUCCESS : EXIT_FAILURE;
+	if(programState.colorBenchSec > 0)
+		return RunColorBenchmark(programState.colorBenchSec) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if(programState.soakTestSec > 0)
+		return RunSoakTest(programState.soakTestSec) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	hr = GetDefaultKinectSensor(&kinect);
+	if(FAILED(hr)) exit(EXIT_FAILURE);
+	
+	hr = kinect->Open();
+	if(FAILED(hr)) exit(EXIT_FAILURE);
+
+	// Getting coordinate mapper
+	hr = kinect->get_CoordinateMapper(&coordMapper);
+	if(FAILED(hr)) exit(EXIT_FAILURE);
+
 	// Asking user if they have enough RAM. 
 	PERFORMANCE_INFORMATION sysInfo;
 	if(!GetPerformanceInfo(&sysInfo, sizeof(sysInfo))) {
@@ -803,12 +1591,28 @@ int main(int argc, char** argv)
 	}
 
 	float ramEstimate = programState.maxFramesToCapture * RAM_MB_PER_FRAME_SET;
+	if(programState.isFilter)
+		ramEstimate += programState.maxFramesToCapture * RAM_MB_PER_FILTERED_SET;
+	if(bodyIndexData.isEnabled)
+		ramEstimate += programState.maxFramesToCapture * RAM_MB_PER_BODY_INDEX;
+	if(longInfraData.isEnabled)
+		ramEstimate += programState.maxFramesToCapture * RAM_MB_PER_LONG_INFRA;
 	float ramAvailable = (float)sysInfo.PageSize * sysInfo.PhysicalAvailable / 1024 / 1024;
 	cout << "   *** CAUTION: THIS PROGRAM EATS YOUR RAM FOR DINNER!!! ***" << endl;
-	cout << "RAM REQUIRED: " << ramEstimate << "MB (Estimate)" << endl;
+
+	// Compressed: expected ratio for now, re-estimated once capture has measured it
+	float ramRequired = ramEstimate;
+	if(programState.isCompress) {
+		ramRequired = ramEstimate / COMPRESS_EXPECTED_RATIO
+			+ (float)COMPRESS_RAW_SLOTS * RAM_MB_PER_FRAME_SET;
+		cout << "RAM REQUIRED: " << ramRequired << "MB (Estimate, assuming " << COMPRESS_EXPECTED_RATIO 
+			<< ":1 compression)" << endl;
+	}
+	else
+		cout << "RAM REQUIRED: " << ramEstimate << "MB (Estimate)" << endl;
 
 	char c = 's';		// default we go ahead with capture
-	if(ramAvailable < ramEstimate * RAM_PADDING_RATIO) {
+	if(ramAvailable < ramRequired * RAM_PADDING_RATIO) {
 		cout << "RAM AVAILABLE: " << ramAvailable << "MB" << endl;
 		cout << "   *** YOU DON'T HAVE ENOUGH RAM!!! ***" << endl;
 		cout << "Enter s to CONTINUE at your own RISK!" << endl;
@@ -818,22 +1622,74 @@ int main(int argc, char** argv)
 
 	if(c == 's' || c == 'S') {
 
-		thread procDepth(ProcessDepth);
-		thread procInfra(ProcessInfra);
-		thread procColor(ProcessColor);
+		if(programState.isLive) {
+			bool ok = depthData.CreateRing() && infraData.CreateRing() && colorData.CreateRing()
+				&& (!bodyIndexData.isEnabled || bodyIndexData.CreateRing())
+				&& (!longInfraData.isEnabled || longInfraData.CreateRing());
+			if(!ok)
+				exit(EXIT_FAILURE);
+		}
+
+		CAPTURE_DONE = false;	// We are not done yet!
+
+		// Color compresses slowest, so one core is left for the capture threads
+		if(programState.isCompress)
+			frameCompressor.Start(std::max(1, NumWorkerThreads() - 1), StreamBuffers<ColorStream>::MaxCompressedBytes());
+
+		std::vector<thread> procThreads;
+		if(programState.isReactor)
+			procThreads.push_back(thread(&ReactorCaptureAll));
+		else {
+			procThreads.push_back(thread(&ProcessStream<DepthStream>, &depthData));
+			procThreads.push_back(thread(&ProcessStream<InfraStream>, &infraData));
+			procThreads.push_back(thread(&ProcessStream<ColorStream>, &colorData));
+			if(bodyIndexData.isEnabled)
+				procThreads.push_back(thread(&ProcessStream<BodyIndexStream>, &bodyIndexData));
+			if(longInfraData.isEnabled)
+				procThreads.push_back(thread(&ProcessStream<LongInfraStream>, &longInfraData));
+		}
+
+		if(programState.isCompress)
+			WatchCompressedCapture(ramEstimate, ramAvailable);
 
-		procDepth.join();
-		procInfra.join();
-		procColor.join();
+		for(size_t t = 0; t < procThreads.size(); ++t)
+			procThreads[t].join();
+
+		if(programState.isCompress) {
+			frameCompressor.Finish();
+			depthData.rawSlots.Free();
+			infraData.rawSlots.Free();
+			colorData.rawSlots.Free();
+			bodyIndexData.rawSlots.Free();
+			longInfraData.rawSlots.Free();
+		}
 
 		cout << "Closing Kinect and cleaning up" << endl;
 
+		depthData.ring.Close();
+		infraData.ring.Close();
+		colorData.ring.Close();
+		bodyIndexData.ring.Close();
+		longInfraData.ring.Close();
+
 		hr = kinect->Close();
 		if(FAILED(hr)) exit(EXIT_FAILURE);
 
-		SafeRelease(depthReader);
-		SafeRelease(infraReader);
-		SafeRelease(colorReader);
+		SafeRelease(depthData.reader);
+		SafeRelease(infraData.reader);
+		SafeRelease(colorData.reader);
+		SafeRelease(bodyIndexData.reader);
+		SafeRelease(longInfraData.reader);
+
+		// Filtering (offline, frames are all in RAM by now)
+		if(programState.isFilter)
+			FilterDepthInfra();
+
+		if(programState.isAnalytics)
+			PrintQualitySummary();
+
+		if(programState.isCompress)
+			PrintCompressionSummary();
 
 		// DUMPING to HDD
 		if(!programState.isDryRun) {
@@ -845,7 +1701,13 @@ int main(int argc, char** argv)
 				std::cerr << GetLastError() << endl;
 				exit(EXIT_FAILURE);
 			}
-			float hddEstimate = DEPTH_FRAMES_CAPTURED * HDD_MB_PER_FRAME_SET;
+			float hddEstimate = depthData.framesCaptured * HDD_MB_PER_FRAME_SET;
+			if(programState.isFilter)
+				hddEstimate += depthData.framesCaptured * HDD_MB_PER_FILTERED_SET;
+			hddEstimate += bodyIndexData.framesCaptured * HDD_MB_PER_BODY_INDEX;
+			hddEstimate += longInfraData.framesCaptured * HDD_MB_PER_LONG_INFRA;
+			if(programState.isRegisterDepth)
+				hddEstimate += colorData.framesCaptured * HDD_MB_PER_REGISTERED_DEPTH;
 			float hddAvailable = (float)hddAvailabeBytes.QuadPart / 1024 / 1024;
 
 			// Making directory based on current time
@@ -898,13 +1760,28 @@ int main(int argc, char** argv)
 
 				cout << "Dumping to HDD. This could take a while... " << endl;
 
-				thread writeDepth(WriteDepth);
-				thread writeInfra(WriteInfra);	
-				thread writeColor(WriteColor);
-
-				writeDepth.join();
-				writeInfra.join();
-				writeColor.join();
+				ioScheduler.Start(false, LargestDumpFileBytes());
+				std::vector<thread> writeThreads;
+				writeThreads.push_back(thread(&WriteStream<DepthStream>, &depthData));
+				writeThreads.push_back(thread(&WriteStream<InfraStream>, &infraData));
+				writeThreads.push_back(thread(&WriteStream<ColorStream>, &colorData));
+				if(bodyIndexData.isEnabled)
+					writeThreads.push_back(thread(&WriteStream<BodyIndexStream>, &bodyIndexData));
+				if(longInfraData.isEnabled)
+					writeThreads.push_back(thread(&WriteStream<LongInfraStream>, &longInfraData));
+
+				for(size_t t = 0; t < writeThreads.size(); ++t)
+					writeThreads[t].join();
+				if(programState.isRegisterDepth)
+					WriteRegisteredDepth();
+				ioScheduler.Finish();
+				if(ioScheduler.Errors() > 0)
+					std::cerr << ioScheduler.Errors() << " files could not be written" << endl;
+
+				if(programState.isAnalytics)
+					WriteQualityReport();
+				if(programState.isReactor)
+					WriteArrivalOrder();
 
 				cout << endl;
 				cout << "ALL DONE!! Enjoy your K4Wv2 Dump" << endl;
@@ -918,6 +1795,8 @@ int main(int argc, char** argv)
 	else {
 		cout << "Use -n <num_seconds> to limit capture time. Lower == less RAM" << endl;
 		cout << "It takes around " << RAM_MB_PER_FRAME_SET * NUM_FRAMES_PER_SECOND << "MB of RAM per second" << endl;
+		if(!programState.isCompress)
+			cout << "Use -c to keep frames compressed in RAM" << endl;
 	}
 
 	return EXIT_SUCCESS;
@@ -0,0 +1,48 @@
+/*
+Small helpers for running the offline (post-capture) stages over many frames at once.
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// Number of worker threads used by the offline stages (filtering etc)
+inline int NumWorkerThreads()
+{
+	int n = (int)std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+// Calls func(worker, frameIdx) for every frameIdx in [0, numFrames)
+// Each worker gets a contiguous chunk of frames so temporal windows stay in cache.
+// worker is in [0, numWorkers) and can be used to index per-thread scratch buffers.
+template<class Func>
+void ParallelForFrames(int numFrames, int numWorkers, Func func)
+{
+	if(numFrames <= 0)
+		return;
+	numWorkers = std::max(1, std::min(numWorkers, numFrames));
+
+	if(numWorkers == 1) {
+		for(int i = 0; i < numFrames; ++i)
+			func(0, i);
+		return;
+	}
+
+	int chunk = (numFrames + numWorkers - 1) / numWorkers;
+	std::vector<std::thread> workers;
+	for(int w = 0; w < numWorkers; ++w)
+	{
+		int begin = w * chunk;
+		int end = std::min(numFrames, begin + chunk);
+		workers.push_back(std::thread([&func, w, begin, end]() {
+			for(int i = begin; i < end; ++i)
+				func(w, i);
+		}));
+	}
+	for(size_t w = 0; w < workers.size(); ++w)
+		workers[w].join();
+}
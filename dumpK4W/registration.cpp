@@ -0,0 +1,388 @@
+/*
+Depth registered into color space. See registration.h
+See main.cpp for license information.
+*/
+
+#include "registration.h"
+
+#include <emmintrin.h>	// SSE2
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// z-buffer value where no depth landed. Above any depth (Kinect is < 8m) and positive as a signed 16 bit
+// value, so _mm_min_epi16 works as the depth test (SSE2 has no unsigned 16 bit min). A repeated byte so
+// clearing the z-buffer is a memset
+static const UINT16 REGISTER_EMPTY = 0x7F7F;
+static const int REGISTER_MAX_TENT_BLOCKS = 10;	// 4 pixel blocks covering the widest bilinear footprint (2 * REGISTER_MAX_SPACING + 1)
+static const int REGISTER_PAD_PIXELS = 64;		// Buffers run this far past the frame, for alignment and the last blocks
+static const int REGISTER_SPACING_ROW_STEP = 4;	// Rows sampled when measuring the spacing
+
+// Footprints of 4 projected depth pixels: color pixels [x0, x1) x [y0, y1), already clipped to the frame
+struct FootprintBounds
+{
+	int x0[4], x1[4], y0[4], y1[4];
+};
+
+// A pixel at integer x covers [x - 0.5, x + 0.5), so a footprint [X - r, X + r) covers
+// pixels floor(X - r + 0.5) to floor(X + r + 0.5) exclusive. Clipping before converting keeps
+// the values non negative (truncation == floor) and sends -inf / NaN (unmapped points) to 0 width
+static inline void ComputeFootprints(const float *colorPoints, __m128 radiusX, __m128 radiusY
+	, __m128 width, __m128 height, FootprintBounds *bounds)
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	__m128 a = _mm_loadu_ps(colorPoints);		// X0 Y0 X1 Y1
+	__m128 b = _mm_loadu_ps(colorPoints + 4);	// X2 Y2 X3 Y3
+	__m128 x = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), half);
+	__m128 y = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), half);
+
+	// _mm_max_ps returns its second operand for NaN
+	__m128 x0 = _mm_min_ps(_mm_max_ps(_mm_sub_ps(x, radiusX), zero), width);
+	__m128 x1 = _mm_min_ps(_mm_max_ps(_mm_add_ps(x, radiusX), zero), width);
+	__m128 y0 = _mm_min_ps(_mm_max_ps(_mm_sub_ps(y, radiusY), zero), height);
+	__m128 y1 = _mm_min_ps(_mm_max_ps(_mm_add_ps(y, radiusY), zero), height);
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(bounds->x0), _mm_cvttps_epi32(x0));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(bounds->x1), _mm_cvttps_epi32(x1));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(bounds->y0), _mm_cvttps_epi32(y0));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(bounds->y1), _mm_cvttps_epi32(y1));
+}
+
+// Scalar ComputeFootprints() for one point, for leftovers
+static inline void ComputeFootprint(const float *colorPoint, float radiusX, float radiusY
+	, int width, int height, int *x0, int *x1, int *y0, int *y1)
+{
+	float x = colorPoint[0] + 0.5f;
+	float y = colorPoint[1] + 0.5f;
+	if(!(x == x) || !(y == y)) {	// NaN
+		*x0 = *x1 = *y0 = *y1 = 0;
+		return;
+	}
+	*x0 = (int)std::min(std::max(x - radiusX, 0.0f), (float)width);
+	*x1 = (int)std::min(std::max(x + radiusX, 0.0f), (float)width);
+	*y0 = (int)std::min(std::max(y - radiusY, 0.0f), (float)height);
+	*y1 = (int)std::min(std::max(y + radiusY, 0.0f), (float)height);
+}
+
+// Ends of a footprint, applied with _mm_max_epi16: the 8 lanes at SPLAT_MASK + 8 - n are REGISTER_EMPTY
+// below lane n, the 8 lanes at SPLAT_MASK + 16 - n are REGISTER_EMPTY from lane n on. 0 elsewhere
+static const UINT16 SPLAT_MASK[24] = { REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY
+	, 0, 0, 0, 0, 0, 0, 0, 0
+	, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY, REGISTER_EMPTY };
+
+// z-buffer write of one footprint: row[x] = min(row[x], z), on the aligned 8 pixel blocks it covers.
+// Lanes outside [x0, x1) are raised to REGISTER_EMPTY so they keep their value. Aligned blocks matter:
+// neighbouring footprints overlap, and an unaligned load straddling the previous store can't be forwarded.
+// zbuf must be 16 byte aligned with stride a multiple of 8. Writes up to 7 pixels past x1 (REGISTER_PAD_PIXELS)
+static inline void SplatMin(UINT16 *zbuf, int stride, int x0, int x1, int y0, int y1, UINT16 z)
+{
+	if(x1 <= x0)
+		return;
+	const int first = x0 & ~7;
+	const int numBlocks = (x1 - first + 7) >> 3;
+	const __m128i zv = _mm_set1_epi16((short)z);
+	const __m128i zFirst = _mm_max_epi16(zv, _mm_loadu_si128(reinterpret_cast<const __m128i*>(SPLAT_MASK + 8 - (x0 - first))));
+	const __m128i zLast = _mm_max_epi16(zv, _mm_loadu_si128(reinterpret_cast<const __m128i*>(SPLAT_MASK + 16 - (x1 - first - 8 * (numBlocks - 1)))));
+
+	if(numBlocks == 1) {
+		const __m128i zOnly = _mm_max_epi16(zFirst, zLast);
+		for(int y = y0; y < y1; ++y)
+		{
+			__m128i *p = reinterpret_cast<__m128i*>(zbuf + y * stride + first);
+			_mm_store_si128(p, _mm_min_epi16(_mm_load_si128(p), zOnly));
+		}
+		return;
+	}
+	for(int y = y0; y < y1; ++y)
+	{
+		__m128i *p = reinterpret_cast<__m128i*>(zbuf + y * stride + first);
+		_mm_store_si128(p, _mm_min_epi16(_mm_load_si128(p), zFirst));
+		for(int b = 1; b + 1 < numBlocks; ++b)
+			_mm_store_si128(p + b, _mm_min_epi16(_mm_load_si128(p + b), zv));
+		p += numBlocks - 1;
+		_mm_store_si128(p, _mm_min_epi16(_mm_load_si128(p), zLast));
+	}
+}
+
+// First element of a workspace buffer on a 16 byte boundary (buffers have REGISTER_PAD_PIXELS to spare)
+template<class T>
+static inline T* Aligned16(T *p)
+{
+	return reinterpret_cast<T*>(((size_t)p + 15) & ~(size_t)15);
+}
+
+// Depth pixels on the same surface (not across an occlusion edge)
+static inline bool IsSameSurface(UINT16 a, UINT16 b)
+{
+	return a != 0 && b != 0 && abs((int)a - (int)b) < REGISTER_SURFACE_MM;
+}
+
+DepthRegistration::DepthRegistration()
+	: depthWidth(0), depthHeight(0), colorWidth(0), colorHeight(0)
+{
+}
+
+void DepthRegistration::Init(int dWidth, int dHeight, int cWidth, int cHeight)
+{
+	depthWidth = dWidth;
+	depthHeight = dHeight;
+	colorWidth = cWidth;
+	colorHeight = cHeight;
+	if(colorWidth % 8) {
+		std::cerr << "Registration needs a color width that is a multiple of 8, not " << colorWidth << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	zbuf.resize((size_t)colorWidth * colorHeight + 2 * REGISTER_PAD_PIXELS);
+	lastValidRow.resize(colorWidth);
+}
+
+void DepthRegistration::Register(const UINT16 *depth, const float *colorPoints, bool isBilinear, UINT16 *out)
+{
+	float spacingX, spacingY;
+	EstimateSpacing(depth, colorPoints, &spacingX, &spacingY);
+
+	memset(&zbuf[0], REGISTER_EMPTY & 0xFF, zbuf.size() * sizeof(UINT16));
+	if(isBilinear) {
+		// Nearest surface over the whole tent first, then blend what is on it
+		SplatNearest(depth, colorPoints, spacingX, spacingY);
+		weights.assign(zbuf.size(), 0.0f);
+		weightedDepth.assign(zbuf.size(), 0.0f);
+		SplatBilinear(depth, colorPoints, spacingX, spacingY);
+		ResolveBilinear(out);
+	}
+	else {
+		SplatNearest(depth, colorPoints, spacingX * 0.5f, spacingY * 0.5f);
+		ResolveNearest(out);
+	}
+	FillHoles(out);
+}
+
+// Average distance in color pixels between neighbouring depth pixels on the same surface
+void DepthRegistration::EstimateSpacing(const UINT16 *depth, const float *colorPoints, float *spacingX, float *spacingY) const
+{
+	double sumX = 0, sumY = 0;
+	int numX = 0, numY = 0;
+	for(int v = 0; v + 1 < depthHeight; v += REGISTER_SPACING_ROW_STEP)
+	{
+		for(int u = 0; u + 1 < depthWidth; ++u)
+		{
+			int j = v * depthWidth + u;
+			if(IsSameSurface(depth[j], depth[j + 1])) {
+				float d = fabs(colorPoints[2*(j + 1)] - colorPoints[2*j]);
+				if(d < REGISTER_MAX_SPACING) {	// False for NaN and inf too
+					sumX += d;
+					++numX;
+				}
+			}
+			if(IsSameSurface(depth[j], depth[j + depthWidth])) {
+				float d = fabs(colorPoints[2*(j + depthWidth) + 1] - colorPoints[2*j + 1]);
+				if(d < REGISTER_MAX_SPACING) {
+					sumY += d;
+					++numY;
+				}
+			}
+		}
+	}
+	*spacingX = numX > 0 ? std::max(1.0f, (float)(sumX / numX)) : REGISTER_DEFAULT_SPACING;
+	*spacingY = numY > 0 ? std::max(1.0f, (float)(sumY / numY)) : REGISTER_DEFAULT_SPACING;
+}
+
+// Keeps the nearest depth of the [X - radiusX, X + radiusX) x [Y - radiusY, Y + radiusY) boxes in zbuf
+void DepthRegistration::SplatNearest(const UINT16 *depth, const float *colorPoints, float radiusX, float radiusY)
+{
+	const int numPixels = depthWidth * depthHeight;
+	const __m128 rx = _mm_set1_ps(radiusX);
+	const __m128 ry = _mm_set1_ps(radiusY);
+	const __m128 width = _mm_set1_ps((float)colorWidth);
+	const __m128 height = _mm_set1_ps((float)colorHeight);
+	UINT16 *z = Aligned16(&zbuf[0]);
+
+	int j = 0;
+	for(; j + 4 <= numPixels; j += 4)
+	{
+		if(!(depth[j] | depth[j+1] | depth[j+2] | depth[j+3]))
+			continue;
+		FootprintBounds b;
+		ComputeFootprints(colorPoints + 2*j, rx, ry, width, height, &b);
+		for(int k = 0; k < 4; ++k)
+			if(depth[j+k])
+				SplatMin(z, colorWidth, b.x0[k], b.x1[k], b.y0[k], b.y1[k], depth[j+k]);
+	}
+
+	// Leftovers
+	for(; j < numPixels; ++j)
+	{
+		if(!depth[j])
+			continue;
+		int x0, x1, y0, y1;
+		ComputeFootprint(colorPoints + 2*j, radiusX, radiusY, colorWidth, colorHeight, &x0, &x1, &y0, &y1);
+		SplatMin(z, colorWidth, x0, x1, y0, y1, depth[j]);
+	}
+}
+
+// Accumulates tent weighted depth of the splats within REGISTER_SURFACE_MM of zbuf, on the aligned
+// 4 pixel blocks each footprint covers (see SplatMin). The tent is separable, so the column weights
+// are computed once per splat and each row only scales them and applies the depth test.
+// Same arithmetic as per pixel: lanes outside the footprint, outside the tent or occluded add 0
+void DepthRegistration::SplatBilinear(const UINT16 *depth, const float *colorPoints, float radiusX, float radiusY)
+{
+	const int numPixels = depthWidth * depthHeight;
+	const float invRadiusY = 1.0f / radiusY;
+	const __m128 invRadiusX = _mm_set1_ps(1.0f / radiusX);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 four = _mm_set1_ps(4.0f);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const __m128i laneIdx = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i fouri = _mm_set1_epi32(4);
+	const __m128i zeroi = _mm_setzero_si128();
+	const UINT16 *z = Aligned16(&zbuf[0]);
+	float *wAll = Aligned16(&weights[0]);
+	float *wdAll = Aligned16(&weightedDepth[0]);
+	// Same number of blocks for every splat keeps the row loop predictable, footprints are at most 2 * radiusX + 1 wide
+	const int numBlocks = std::min(((int)(2 * radiusX) + 1 + 6) / 4, REGISTER_MAX_TENT_BLOCKS);
+	__m128 tentX[REGISTER_MAX_TENT_BLOCKS];
+
+	for(int j = 0; j < numPixels; ++j)
+	{
+		const UINT16 d = depth[j];
+		if(!d)
+			continue;
+		int x0, x1, y0, y1;
+		ComputeFootprint(colorPoints + 2*j, radiusX, radiusY, colorWidth, colorHeight, &x0, &x1, &y0, &y1);
+		if(x1 <= x0)
+			continue;
+		const float cy = colorPoints[2*j + 1];
+		const int first = x0 & ~3;
+
+		// Column weights, 0 outside [x0, x1) and outside the tent
+		const __m128 cx = _mm_set1_ps(colorPoints[2*j]);
+		const __m128i begin = _mm_set1_epi32(x0 - 1);
+		const __m128i end = _mm_set1_epi32(x1);
+		__m128 xf = _mm_add_ps(_mm_set1_ps((float)first), _mm_setr_ps(0, 1, 2, 3));
+		__m128i xi = _mm_add_epi32(_mm_set1_epi32(first), laneIdx);
+		for(int b = 0; b < numBlocks; ++b)
+		{
+			__m128 wx = _mm_sub_ps(one, _mm_mul_ps(_mm_and_ps(_mm_sub_ps(xf, cx), absMask), invRadiusX));
+			__m128i inside = _mm_and_si128(_mm_cmpgt_epi32(xi, begin), _mm_cmplt_epi32(xi, end));
+			tentX[b] = _mm_and_ps(wx, _mm_and_ps(_mm_cmpgt_ps(wx, zero), _mm_castsi128_ps(inside)));
+			xf = _mm_add_ps(xf, four);
+			xi = _mm_add_epi32(xi, fouri);
+		}
+
+		const __m128 dv = _mm_set1_ps((float)d);
+		const __m128i occluder = _mm_set1_epi32((int)d - REGISTER_SURFACE_MM);	// zbuf below this occludes d
+		for(int y = y0; y < y1; ++y)
+		{
+			float wy = 1.0f - fabs(y - cy) * invRadiusY;
+			if(wy <= 0)
+				continue;
+			const __m128 wyv = _mm_set1_ps(wy);
+			const size_t offset = (size_t)y * colorWidth + first;
+			const UINT16 *zRow = z + offset;
+			float *wRow = wAll + offset;
+			float *wdRow = wdAll + offset;
+			for(int b = 0; b < numBlocks; ++b)
+			{
+				__m128i zi = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(zRow + 4*b)), zeroi);
+				__m128 occluded = _mm_castsi128_ps(_mm_cmpgt_epi32(occluder, zi));
+				__m128 w = _mm_andnot_ps(occluded, _mm_mul_ps(wyv, tentX[b]));
+				_mm_store_ps(wRow + 4*b, _mm_add_ps(_mm_load_ps(wRow + 4*b), w));
+				_mm_store_ps(wdRow + 4*b, _mm_add_ps(_mm_load_ps(wdRow + 4*b), _mm_mul_ps(w, dv)));
+			}
+		}
+	}
+}
+
+// out = zbuf with REGISTER_EMPTY -> 0, 8 pixels at a time
+void DepthRegistration::ResolveNearest(UINT16 *out) const
+{
+	const int numPixels = colorWidth * colorHeight;
+	const __m128i empty = _mm_set1_epi16((short)REGISTER_EMPTY);
+	const UINT16 *z = Aligned16(&zbuf[0]);
+
+	int p = 0;
+	for(; p + 8 <= numPixels; p += 8)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(z + p));
+		v = _mm_andnot_si128(_mm_cmpeq_epi16(v, empty), v);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + p), v);
+	}
+	for(; p < numPixels; ++p)
+		out[p] = z[p] == REGISTER_EMPTY ? 0 : z[p];
+}
+
+// out = weightedDepth / weights rounded, 0 where nothing landed. 8 pixels at a time
+void DepthRegistration::ResolveBilinear(UINT16 *out) const
+{
+	const int numPixels = colorWidth * colorHeight;
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 tiny = _mm_set1_ps(1e-6f);
+	const __m128 maxDepth = _mm_set1_ps(32767.0f);	// Fits the signed pack below. Kinect depth is < 8m
+	const float *w = Aligned16(&weights[0]);
+	const float *wd = Aligned16(&weightedDepth[0]);
+
+	int p = 0;
+	for(; p + 8 <= numPixels; p += 8)
+	{
+		__m128i lanes[2];
+		for(int h = 0; h < 2; ++h)
+		{
+			__m128 weight = _mm_loadu_ps(w + p + 4*h);
+			__m128 d = _mm_div_ps(_mm_loadu_ps(wd + p + 4*h), _mm_max_ps(weight, tiny));
+			d = _mm_min_ps(_mm_add_ps(d, half), maxDepth);
+			d = _mm_and_ps(d, _mm_cmpgt_ps(weight, zero));
+			lanes[h] = _mm_cvttps_epi32(d);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + p), _mm_packs_epi32(lanes[0], lanes[1]));
+	}
+	for(; p < numPixels; ++p)
+		out[p] = w[p] > 0 ? (UINT16)std::min(wd[p] / w[p] + 0.5f, 32767.0f) : 0;
+}
+
+// Fills holes of up to REGISTER_MAX_HOLE_PIXELS between two depths with the farther one,
+// first along rows, then along columns (walking rows so memory is read in order)
+void DepthRegistration::FillHoles(UINT16 *out)
+{
+	for(int y = 0; y < colorHeight; ++y)
+	{
+		UINT16 *row = out + (size_t)y * colorWidth;
+		int last = -1;
+		for(int x = 0; x < colorWidth; ++x)
+		{
+			if(!row[x])
+				continue;
+			int gap = x - last - 1;
+			if(last >= 0 && gap > 0 && gap <= REGISTER_MAX_HOLE_PIXELS) {
+				UINT16 background = std::max(row[last], row[x]);
+				for(int h = last + 1; h < x; ++h)
+					row[h] = background;
+			}
+			last = x;
+		}
+	}
+
+	std::fill(lastValidRow.begin(), lastValidRow.end(), -1);
+	for(int y = 0; y < colorHeight; ++y)
+	{
+		UINT16 *row = out + (size_t)y * colorWidth;
+		for(int x = 0; x < colorWidth; ++x)
+		{
+			if(!row[x])
+				continue;
+			int last = lastValidRow[x];
+			int gap = y - last - 1;
+			if(last >= 0 && gap > 0 && gap <= REGISTER_MAX_HOLE_PIXELS) {
+				UINT16 background = std::max(out[(size_t)last * colorWidth + x], row[x]);
+				for(int h = last + 1; h < y; ++h)
+					out[(size_t)h * colorWidth + x] = background;
+			}
+			lastValidRow[x] = y;
+		}
+	}
+}
@@ -0,0 +1,66 @@
+/*
+Depth registered into color space (-z). The opposite of rgbMapped: instead of
+sampling color at every depth pixel, every depth pixel is projected onto the
+1920x1080 color frame, giving a depth image aligned with the color image.
+
+Depth is ~3x coarser than color, so each depth pixel is splatted over a
+footprint the size of its spacing in color space (measured per frame from
+neighbouring pixels on the same surface):
+
+	nearest		A box footprint. A z-buffer keeps the nearest depth where
+				footprints overlap, so foreground occludes background.
+	bilinear	A tent (bilinear) footprint twice the size. Splats within
+				REGISTER_SURFACE_MM of the nearest surface at a color pixel are
+				blended by weight, farther ones are occluded. Smoother surfaces.
+
+Holes left behind (background revealed by parallax, where depth saw nothing)
+of up to REGISTER_MAX_HOLE_PIXELS along a row or column are filled from the
+farther of the two sides, i.e. the background, so foreground edges don't grow.
+
+Footprint bounds, the z-buffer splat (depth test and footprint write), the
+bilinear accumulation and the final resolve are SSE2, 4 and 8 pixels at a time.
+Parallelism is over frames (see parallel.h) with one DepthRegistration
+workspace per worker.
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+
+static const UINT16 REGISTER_SURFACE_MM = 50;		// Bilinear: blended splats are within this of the nearest
+static const int REGISTER_MAX_HOLE_PIXELS = 48;		// Longest hole (color pixels) filled. Parallax of ~1m vs 3m
+static const float REGISTER_DEFAULT_SPACING = 2.9f;	// Depth pixel spacing in color pixels if it can't be measured
+static const float REGISTER_MAX_SPACING = 16.0f;
+
+class DepthRegistration
+{
+public:
+	DepthRegistration();
+
+	// Allocates the workspace. colorWidth must be a multiple of 8 (rows of the z-buffer stay 16 byte aligned)
+	void Init(int depthWidth, int depthHeight, int colorWidth, int colorHeight);
+
+	// depth is depthWidth x depthHeight (mm, 0 = invalid). colorPoints holds X, Y in color space of each
+	// depth pixel (ColorSpacePoint layout, e.g. from ICoordinateMapper::MapDepthFrameToColorSpace).
+	// out is colorWidth x colorHeight depth (mm), 0 where there is none
+	void Register(const UINT16 *depth, const float *colorPoints, bool isBilinear, UINT16 *out);
+
+private:
+	void EstimateSpacing(const UINT16 *depth, const float *colorPoints, float *spacingX, float *spacingY) const;
+	void SplatNearest(const UINT16 *depth, const float *colorPoints, float radiusX, float radiusY);
+	void SplatBilinear(const UINT16 *depth, const float *colorPoints, float radiusX, float radiusY);
+	void ResolveNearest(UINT16 *out) const;
+	void ResolveBilinear(UINT16 *out) const;
+	void FillHoles(UINT16 *out);
+
+	int depthWidth, depthHeight;
+	int colorWidth, colorHeight;
+
+	std::vector<UINT16> zbuf;			// Nearest depth so far, REGISTER_EMPTY if none
+	std::vector<float> weights;			// Bilinear only
+	std::vector<float> weightedDepth;
+	std::vector<int> lastValidRow;		// Hole filling, per column
+};
@@ -0,0 +1,73 @@
+/*
+Bounded single producer / single consumer queue without locks, for handing
+captured frames from the capture reactor to the processing thread (-r).
+
+Push() and Pop() never block or allocate. Exactly one thread may push and
+exactly one other thread may pop. Items written before Push() are visible
+to the thread that pops them (release / acquire on the indices).
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+template<class T>
+class SpscQueue
+{
+public:
+	// capacity is rounded up to a power of 2
+	explicit SpscQueue(size_t capacity)
+		: head(0), tail(0)
+	{
+		size_t n = 1;
+		while(n < capacity)
+			n <<= 1;
+		items.resize(n);
+		mask = n - 1;
+	}
+
+	// False if full
+	bool Push(const T &item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if(t - head.load(std::memory_order_acquire) > mask)
+			return false;
+		items[t & mask] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// False if empty
+	bool Pop(T *item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if(h == tail.load(std::memory_order_acquire))
+			return false;
+		*item = items[h & mask];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Only exact when neither side is busy
+	size_t Size() const
+	{
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+private:
+	std::vector<T> items;
+	size_t mask;
+
+	// Producer and consumer indices on separate cache lines
+	char padBefore[64];
+	std::atomic<size_t> head;	// Next item to pop, written by the consumer
+	char padMiddle[64];
+	std::atomic<size_t> tail;	// Next free slot, written by the producer
+	char padAfter[64];
+
+	SpscQueue(const SpscQueue&);
+	SpscQueue& operator=(const SpscQueue&);
+};
@@ -0,0 +1,444 @@
+/*
+Stream traits for the capture / dump pipeline in main.cpp.
+
+ProcessStream<Stream>() and WriteStream<Stream>() are written once and
+specialised at compile time by one of the traits structs below, so each
+stream gets its own copy of the capture and dump loops with no virtual
+calls per frame. A traits struct gives:
+
+	Pixel, ELEMENTS_PER_PIXEL	Buffer element type and elements per pixel
+	WIDTH, HEIGHT
+	Source, Reader, EventArgs, FrameReference, Frame	Kinect SDK interfaces
+	Encoder						Writes one frame through the I/O scheduler (see TiffEncoder)
+	Name(), FilePrefix(), RingName()
+	GetSource(), CopyFrame()	Kinect SDK calls that differ between streams
+	Preview()					Shows a captured frame, if HAS_PREVIEW
+	Analyze()					Quality stats (analytics.h), if HAS_ANALYTICS
+	Compress(), Decompress()	Lossless codec (codec.h) for the compressed store (-c)
+
+Adding a stream means adding a traits struct, a StreamBuffers global and
+the threads in main().
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Kinect.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "analytics.h"
+#include "framering.h"
+#include "codec.h"
+#include "framestore.h"
+#include "iosched.h"
+#include "tiffwriter.h"
+
+static const int PREVIEW_DEPTH_SCALE = 18;	// Scales depth up to allow OpenCV visualisation
+static const int PREVIEW_BODY_INDEX_SCALE = 40;	// Body indices 0-5 to visible grays, no body (255) stays white
+
+// <dumpPath><prefix>XXXXXXXX<extension> into filename (MAX_PATH chars), so the dump loop doesn't allocate
+inline void FrameFilename(char *filename, const std::string &dumpPath, const char *prefix, int i, const char *extension)
+{
+	_snprintf_s(filename, MAX_PATH, _TRUNCATE, "%s%s%08d%s", dumpPath.c_str(), prefix, i, extension);
+}
+
+// Writes bytes as they are, through io like SaveImage()
+inline void SaveRaw(IoScheduler *io, const char *filename, const BYTE *data, size_t bytes)
+{
+	if(!io) {
+		FILE *file = fopen(filename, "wb");
+		if(file) {
+			fwrite(data, 1, bytes, file);
+			fclose(file);
+		}
+		return;
+	}
+	IoBuffer *file = io->Acquire();
+	strcpy_s(file->filename, MAX_PATH, filename);
+	file->data.assign(data, data + bytes);
+	io->Submit(file);
+}
+
+// Default encoder: one 16 or 8 bit single channel tiff per frame
+template<class Stream>
+class TiffEncoder
+{
+public:
+	TiffEncoder(const std::string &dumpPath, bool isVerbose, IoScheduler *io)
+		: dumpPath(dumpPath), isVerbose(isVerbose), io(io)
+	{
+	}
+
+	void Encode(const std::string &prefix, int i, const typename Stream::Pixel *buf, TIMESPAN /*relTime*/)
+	{
+		FrameFilename(filename, dumpPath, prefix.c_str(), i, ".tiff");
+		if(isVerbose)
+			std::cout << "Writing: " << filename << std::endl;
+
+		cv::Mat image(Stream::HEIGHT, Stream::WIDTH, Stream::CV_TYPE, const_cast<typename Stream::Pixel*>(buf), cv::Mat::AUTO_STEP);
+		SaveImage(io, filename, image);
+	}
+
+private:
+	std::string dumpPath;
+	bool isVerbose;
+	IoScheduler *io;
+	char filename[MAX_PATH];
+};
+
+// Shows a single channel frame mirrored (K4W has things the wrong way around...)
+template<class Stream>
+inline void PreviewMirrored(const typename Stream::Pixel *buf, cv::Mat &flipped, double scale)
+{
+	cv::Mat image(Stream::HEIGHT, Stream::WIDTH, Stream::CV_TYPE, const_cast<typename Stream::Pixel*>(buf), cv::Mat::AUTO_STEP);
+	cv::flip(image, flipped, 1);	// Mirror about y axis
+	if(scale != 1.0)
+		cv::imshow(Stream::Name(), flipped * scale);
+	else
+		cv::imshow(Stream::Name(), flipped);
+}
+
+struct DepthStream
+{
+	typedef UINT16 Pixel;
+	static const int ELEMENTS_PER_PIXEL = 1;
+	static const int WIDTH = 512;
+	static const int HEIGHT = 424;
+	static const int CV_TYPE = CV_16UC1;
+	static const bool HAS_PREVIEW = true;
+	static const bool HAS_ANALYTICS = true;
+
+	typedef IDepthFrameSource Source;
+	typedef IDepthFrameReader Reader;
+	typedef IDepthFrameArrivedEventArgs EventArgs;
+	typedef IDepthFrameReference FrameReference;
+	typedef IDepthFrame Frame;
+	typedef TiffEncoder<DepthStream> Encoder;
+
+	static const char* Name() { return "Depth"; }
+	static const char* FilePrefix() { return "depth"; }
+	static const wchar_t* RingName() { return LIVE_RING_DEPTH_NAME; }
+
+	static HRESULT GetSource(IKinectSensor *kinect, Source **src) { return kinect->get_DepthFrameSource(src); }
+	static HRESULT CopyFrame(Frame *frame, Pixel *buf) { return frame->CopyFrameDataToArray(WIDTH*HEIGHT, buf); }
+	static void Preview(const Pixel *buf, cv::Mat &scratch) { PreviewMirrored<DepthStream>(buf, scratch, PREVIEW_DEPTH_SCALE); }
+	static void Analyze(FrameAnalyzer &analyzer, const Pixel *buf, FrameStats *stats) { analyzer.AnalyzeDepth(buf, WIDTH*HEIGHT, stats); }
+	static size_t Compress(const Pixel *buf, BYTE *dst) { return Compress16(buf, WIDTH, HEIGHT, dst); }
+	static void Decompress(const BYTE *src, Pixel *buf) { Decompress16(src, WIDTH, HEIGHT, buf); }
+};
+
+struct InfraStream
+{
+	typedef UINT16 Pixel;
+	static const int ELEMENTS_PER_PIXEL = 1;
+	static const int WIDTH = 512;
+	static const int HEIGHT = 424;
+	static const int CV_TYPE = CV_16UC1;
+	static const bool HAS_PREVIEW = true;
+	static const bool HAS_ANALYTICS = true;
+
+	typedef IInfraredFrameSource Source;
+	typedef IInfraredFrameReader Reader;
+	typedef IInfraredFrameArrivedEventArgs EventArgs;
+	typedef IInfraredFrameReference FrameReference;
+	typedef IInfraredFrame Frame;
+	typedef TiffEncoder<InfraStream> Encoder;
+
+	static const char* Name() { return "Infra"; }
+	static const char* FilePrefix() { return "infra"; }
+	static const wchar_t* RingName() { return LIVE_RING_INFRA_NAME; }
+
+	static HRESULT GetSource(IKinectSensor *kinect, Source **src) { return kinect->get_InfraredFrameSource(src); }
+	static HRESULT CopyFrame(Frame *frame, Pixel *buf) { return frame->CopyFrameDataToArray(WIDTH*HEIGHT, buf); }
+	static void Preview(const Pixel *buf, cv::Mat &scratch) { PreviewMirrored<InfraStream>(buf, scratch, 1.0); }
+	static void Analyze(FrameAnalyzer &analyzer, const Pixel *buf, FrameStats *stats) { analyzer.AnalyzeInfra(buf, WIDTH*HEIGHT, stats); }
+	static size_t Compress(const Pixel *buf, BYTE *dst) { return Compress16(buf, WIDTH, HEIGHT, dst); }
+	static void Decompress(const BYTE *src, Pixel *buf) { Decompress16(src, WIDTH, HEIGHT, buf); }
+};
+
+struct LongInfraStream
+{
+	typedef UINT16 Pixel;
+	static const int ELEMENTS_PER_PIXEL = 1;
+	static const int WIDTH = 512;
+	static const int HEIGHT = 424;
+	static const int CV_TYPE = CV_16UC1;
+	static const bool HAS_PREVIEW = true;
+	static const bool HAS_ANALYTICS = true;
+
+	typedef ILongExposureInfraredFrameSource Source;
+	typedef ILongExposureInfraredFrameReader Reader;
+	typedef ILongExposureInfraredFrameArrivedEventArgs EventArgs;
+	typedef ILongExposureInfraredFrameReference FrameReference;
+	typedef ILongExposureInfraredFrame Frame;
+	typedef TiffEncoder<LongInfraStream> Encoder;
+
+	static const char* Name() { return "LongInfra"; }
+	static const char* FilePrefix() { return "longInfra"; }
+	static const wchar_t* RingName() { return LIVE_RING_LONG_INFRA_NAME; }
+
+	static HRESULT GetSource(IKinectSensor *kinect, Source **src) { return kinect->get_LongExposureInfraredFrameSource(src); }
+	static HRESULT CopyFrame(Frame *frame, Pixel *buf) { return frame->CopyFrameDataToArray(WIDTH*HEIGHT, buf); }
+	static void Preview(const Pixel *buf, cv::Mat &scratch) { PreviewMirrored<LongInfraStream>(buf, scratch, 1.0); }
+	static void Analyze(FrameAnalyzer &analyzer, const Pixel *buf, FrameStats *stats) { analyzer.AnalyzeInfra(buf, WIDTH*HEIGHT, stats); }
+	static size_t Compress(const Pixel *buf, BYTE *dst) { return Compress16(buf, WIDTH, HEIGHT, dst); }
+	static void Decompress(const BYTE *src, Pixel *buf) { Decompress16(src, WIDTH, HEIGHT, buf); }
+};
+
+struct BodyIndexStream
+{
+	typedef BYTE Pixel;
+	static const int ELEMENTS_PER_PIXEL = 1;
+	static const int WIDTH = 512;
+	static const int HEIGHT = 424;
+	static const int CV_TYPE = CV_8UC1;
+	static const bool HAS_PREVIEW = true;
+	static const bool HAS_ANALYTICS = false;
+
+	typedef IBodyIndexFrameSource Source;
+	typedef IBodyIndexFrameReader Reader;
+	typedef IBodyIndexFrameArrivedEventArgs EventArgs;
+	typedef IBodyIndexFrameReference FrameReference;
+	typedef IBodyIndexFrame Frame;
+	typedef TiffEncoder<BodyIndexStream> Encoder;
+
+	static const char* Name() { return "BodyIndex"; }
+	static const char* FilePrefix() { return "bodyIndex"; }
+	static const wchar_t* RingName() { return LIVE_RING_BODY_INDEX_NAME; }
+
+	static HRESULT GetSource(IKinectSensor *kinect, Source **src) { return kinect->get_BodyIndexFrameSource(src); }
+	static HRESULT CopyFrame(Frame *frame, Pixel *buf) { return frame->CopyFrameDataToArray(WIDTH*HEIGHT, buf); }
+	static void Preview(const Pixel *buf, cv::Mat &scratch) { PreviewMirrored<BodyIndexStream>(buf, scratch, PREVIEW_BODY_INDEX_SCALE); }
+	static void Analyze(FrameAnalyzer&, const Pixel*, FrameStats*) {}
+	static size_t Compress(const Pixel *buf, BYTE *dst) { return Compress8(buf, WIDTH, HEIGHT, dst); }
+	static void Decompress(const BYTE *src, Pixel *buf) { Decompress8(src, WIDTH, HEIGHT, buf); }
+};
+
+// Color dumping also needs depth for mapping to depth space, see ColorEncoder in main.cpp
+class ColorEncoder;
+
+// Note that Raw color is YUY2 (Flipped UYVY), 2 bytes per pixel
+struct ColorStream
+{
+	typedef BYTE Pixel;
+	static const int ELEMENTS_PER_PIXEL = 2;
+	static const int WIDTH = 1920;
+	static const int HEIGHT = 1080;
+	static const int CV_TYPE = CV_8UC2;
+	static const bool HAS_PREVIEW = false;	// TODO How to visualise RGB? Maybe just show Y channel (C1)
+	static const bool HAS_ANALYTICS = false;
+
+	typedef IColorFrameSource Source;
+	typedef IColorFrameReader Reader;
+	typedef IColorFrameArrivedEventArgs EventArgs;
+	typedef IColorFrameReference FrameReference;
+	typedef IColorFrame Frame;
+	typedef ColorEncoder Encoder;
+
+	static const char* Name() { return "Color"; }
+	static const char* FilePrefix() { return "color"; }
+	static const wchar_t* RingName() { return LIVE_RING_COLOR_NAME; }
+
+	static HRESULT GetSource(IKinectSensor *kinect, Source **src) { return kinect->get_ColorFrameSource(src); }
+	static HRESULT CopyFrame(Frame *frame, Pixel *buf) { return frame->CopyRawFrameDataToArray(WIDTH*HEIGHT*ELEMENTS_PER_PIXEL, buf); }
+	static void Preview(const Pixel*, cv::Mat&) {}
+	static void Analyze(FrameAnalyzer&, const Pixel*, FrameStats*) {}
+	static size_t Compress(const Pixel *buf, BYTE *dst) { return CompressYUY2(buf, WIDTH, HEIGHT, dst); }
+	static void Decompress(const BYTE *src, Pixel *buf) { DecompressYUY2(src, WIDTH, HEIGHT, buf); }
+};
+
+// Everything captured for one stream
+template<class Stream>
+struct StreamBuffers
+{
+	typedef typename Stream::Pixel Pixel;
+
+	bool isEnabled;
+	typename Stream::Reader *reader;
+
+	Pixel **bufArray;				// Raw frames from the sensor, NULL if compressed
+	Pixel **filteredBufArray;		// Cleaned up copies (-f), NULL if not filtered or compressed
+	CompressedFrame *compressedArray;			// Raw frames in the compressed store (-c), else NULL
+	CompressedFrame *filteredCompressedArray;	// Ditto for filtered frames
+	TIMESPAN *relTimeArray;			// Time Stamps (relative)
+	FrameStats *statsArray;			// Quality stats (-a), NULL if not analysed
+	int framesCaptured;				// Number of frames captured to RAM
+	int allocatedFrames;
+
+	FrameAnalyzer analyzer;
+	FrameRingWriter ring;			// Live publishing (-l), open if publishing
+	RawSlotPool rawSlots;			// Capture buffers waiting for compression (-c)
+
+	StreamBuffers()
+		: isEnabled(false), reader(NULL), bufArray(NULL), filteredBufArray(NULL)
+		, compressedArray(NULL), filteredCompressedArray(NULL)
+		, relTimeArray(NULL), statsArray(NULL), framesCaptured(0), allocatedFrames(0)
+	{
+	}
+
+	static int ElementsPerFrame() { return Stream::WIDTH * Stream::HEIGHT * Stream::ELEMENTS_PER_PIXEL; }
+	static int BytesPerFrame() { return ElementsPerFrame() * sizeof(Pixel); }
+	static size_t MaxCompressedBytes() { return CodecMaxBytes(ElementsPerFrame()); }
+
+	void Allocate(int maxFrames, bool withStats, bool isCompressed)
+	{
+		allocatedFrames = maxFrames;
+		relTimeArray = new TIMESPAN[maxFrames];
+		memset(relTimeArray, 0, sizeof(TIMESPAN)*maxFrames);
+		if(isCompressed) {
+			compressedArray = new CompressedFrame[maxFrames];
+			memset(compressedArray, 0, sizeof(CompressedFrame)*maxFrames);
+			rawSlots.Init(BytesPerFrame(), COMPRESS_RAW_SLOTS);
+		}
+		else {
+			bufArray = new Pixel*[maxFrames];
+			for(int i = 0; i < maxFrames; ++i)
+				bufArray[i] = new Pixel[ElementsPerFrame()];
+		}
+		if(withStats && Stream::HAS_ANALYTICS)
+			statsArray = new FrameStats[maxFrames];
+	}
+
+	// Back to the state before Allocate(). Compressed frame data lives in the FrameCompressor arena
+	void Free()
+	{
+		for(int i = 0; bufArray && i < allocatedFrames; ++i)
+			delete [] bufArray[i];
+		for(int i = 0; filteredBufArray && i < framesCaptured; ++i)
+			delete [] filteredBufArray[i];
+		delete [] bufArray;
+		delete [] filteredBufArray;
+		delete [] compressedArray;
+		delete [] filteredCompressedArray;
+		delete [] relTimeArray;
+		delete [] statsArray;
+		bufArray = filteredBufArray = NULL;
+		compressedArray = filteredCompressedArray = NULL;
+		relTimeArray = NULL;
+		statsArray = NULL;
+		framesCaptured = 0;
+		allocatedFrames = 0;
+		rawSlots.Free();
+		analyzer = FrameAnalyzer();
+	}
+
+	bool IsCompressed() const { return compressedArray != NULL; }
+	bool HasFiltered() const { return filteredBufArray != NULL || filteredCompressedArray != NULL; }
+
+	// Buffer the sensor copies frame i into. NULL with -c if compression is too far behind (see RawSlotPool)
+	Pixel* CaptureBuffer(int i)
+	{
+		return IsCompressed() ? static_cast<Pixel*>(rawSlots.Acquire()) : bufArray[i];
+	}
+
+	// Done with the capture buffer of frame i. Compressed in the background with -c
+	void Store(int i, Pixel *buf, FrameCompressor &compressor)
+	{
+		if(IsCompressed())
+			compressor.Submit(buf, BytesPerFrame(), &CompressFrame, &rawSlots, compressedArray + i);
+	}
+
+	// Frame i. Compressed frames are decompressed into scratch (ElementsPerFrame() long)
+	const Pixel* Frame(int i, Pixel *scratch) const
+	{
+		if(!IsCompressed())
+			return bufArray[i];
+		Stream::Decompress(compressedArray[i].data, scratch);
+		return scratch;
+	}
+
+	void AllocateFiltered()
+	{
+		if(IsCompressed()) {
+			filteredCompressedArray = new CompressedFrame[framesCaptured];
+			memset(filteredCompressedArray, 0, sizeof(CompressedFrame)*framesCaptured);
+			return;
+		}
+		filteredBufArray = new Pixel*[framesCaptured];
+		for(int i = 0; i < framesCaptured; ++i)
+			filteredBufArray[i] = new Pixel[ElementsPerFrame()];
+	}
+
+	// Where the filter writes filtered frame i: in place, or scratch which StoreFiltered() compresses
+	Pixel* FilteredTarget(int i, Pixel *scratch)
+	{
+		return IsCompressed() ? scratch : filteredBufArray[i];
+	}
+
+	// codecScratch is MaxCompressedBytes() long
+	void StoreFiltered(int i, const Pixel *buf, BYTE *codecScratch, FrameCompressor &compressor)
+	{
+		if(IsCompressed())
+			compressor.CompressNow(buf, BytesPerFrame(), &CompressFrame, codecScratch, filteredCompressedArray + i);
+	}
+
+	const Pixel* FilteredFrame(int i, Pixel *scratch) const
+	{
+		if(!IsCompressed())
+			return filteredBufArray[i];
+		Stream::Decompress(filteredCompressedArray[i].data, scratch);
+		return scratch;
+	}
+
+	bool CreateRing()
+	{
+		return ring.Create(Stream::RingName(), Stream::WIDTH, Stream::HEIGHT
+			, Stream::ELEMENTS_PER_PIXEL * sizeof(Pixel), LIVE_RING_DEFAULT_SLOTS);
+	}
+
+private:
+	static size_t CompressFrame(const void *raw, BYTE *dst)
+	{
+		return Stream::Compress(static_cast<const Pixel*>(raw), dst);
+	}
+};
+
+// Frames of a sliding temporal window for one worker of the filter stage. On a compressed
+// store each frame is decompressed once per worker instead of once per window it is in.
+// Frame i lives in cache slot i % size, so a window of up to size consecutive frames never evicts itself
+template<class Stream>
+class FrameWindowCache
+{
+public:
+	typedef typename Stream::Pixel Pixel;
+
+	FrameWindowCache() : data(NULL), size(0) {}
+
+	void Init(const StreamBuffers<Stream> *buffers, int numSlots)
+	{
+		data = buffers;
+		size = numSlots;
+		if(data->IsCompressed()) {
+			storage.resize((size_t)size * StreamBuffers<Stream>::ElementsPerFrame());
+			cached.assign(size, -1);
+		}
+	}
+
+	const Pixel* Get(int i)
+	{
+		if(!data->IsCompressed())
+			return data->bufArray[i];
+
+		int slot = i % size;
+		Pixel *buf = &storage[(size_t)slot * StreamBuffers<Stream>::ElementsPerFrame()];
+		if(cached[slot] != i) {
+			data->Frame(i, buf);
+			cached[slot] = i;
+		}
+		return buf;
+	}
+
+private:
+	const StreamBuffers<Stream> *data;
+	int size;
+	std::vector<Pixel> storage;
+	std::vector<int> cached;
+};
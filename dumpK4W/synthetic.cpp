@@ -0,0 +1,79 @@
+/*
+Deterministic synthetic frames. See synthetic.h
+See main.cpp for license information.
+*/
+
+#include "synthetic.h"
+
+SyntheticSource::SyntheticSource(int numDistinctFrames)
+	: numFrames(numDistinctFrames > 0 ? numDistinctFrames : 1)
+{
+	const int W = SYNTHETIC_WIDTH, H = SYNTHETIC_HEIGHT;
+	const int CW = SYNTHETIC_COLOR_WIDTH, CH = SYNTHETIC_COLOR_HEIGHT;
+
+	depth.resize((size_t)numFrames * W * H);
+	infra.resize((size_t)numFrames * W * H);
+	color.resize((size_t)numFrames * CW * CH * 2);
+
+	// Simple LCG so sensor-like noise is the same on every run
+	UINT32 rng = 12345;
+
+	for(int f = 0; f < numFrames; ++f)
+	{
+		// Box sweeping left to right in front of a sloped wall
+		int boxX = (W / 4) + f * (W / 2) / numFrames;
+		int boxY = H / 3;
+		int boxSize = H / 4;
+
+		UINT16 *d = &depth[(size_t)f * W * H];
+		UINT16 *ir = &infra[(size_t)f * W * H];
+		for(int y = 0; y < H; ++y)
+		{
+			for(int x = 0; x < W; ++x)
+			{
+				rng = rng * 1664525 + 1013904223;
+				int noise = (int)(rng >> 28) - 8;
+
+				bool inBox = x >= boxX && x < boxX + boxSize && y >= boxY && y < boxY + boxSize;
+				int z = inBox ? 1200 : 2500 + 2 * y;
+				d[y*W + x] = (UINT16)(z + noise);
+
+				// Brighter when closer, dark corners like the real sensor
+				int edge = (x < 16 || x >= W - 16) ? 0 : 1;
+				ir[y*W + x] = (UINT16)(edge * (inBox ? 6000 : 1500) + 4 * noise + 64);
+			}
+		}
+
+		BYTE *c = &color[(size_t)f * CW * CH * 2];
+		int cBoxX = boxX * CW / W;
+		int cBoxY = boxY * CH / H;
+		int cBoxSize = boxSize * CH / H;
+		for(int y = 0; y < CH; ++y)
+		{
+			for(int x = 0; x < CW; x += 2)
+			{
+				bool inBox = x >= cBoxX && x < cBoxX + cBoxSize && y >= cBoxY && y < cBoxY + cBoxSize;
+				BYTE *px = c + (y*CW + x) * 2;
+				px[0] = (BYTE)(inBox ? 180 : 40 + (y * 160) / CH);	// Y0
+				px[1] = (BYTE)(inBox ? 90 : 128);					// U
+				px[2] = (BYTE)(inBox ? 180 : 40 + (y * 160) / CH);	// Y1
+				px[3] = (BYTE)(inBox ? 200 : 128 + (x * 32) / CW);	// V
+			}
+		}
+	}
+}
+
+const UINT16* SyntheticSource::Depth(int i) const
+{
+	return &depth[(size_t)(i % numFrames) * SYNTHETIC_WIDTH * SYNTHETIC_HEIGHT];
+}
+
+const UINT16* SyntheticSource::Infra(int i) const
+{
+	return &infra[(size_t)(i % numFrames) * SYNTHETIC_WIDTH * SYNTHETIC_HEIGHT];
+}
+
+const BYTE* SyntheticSource::Color(int i) const
+{
+	return &color[(size_t)(i % numFrames) * SYNTHETIC_COLOR_WIDTH * SYNTHETIC_COLOR_HEIGHT * 2];
+}
@@ -0,0 +1,47 @@
+/*
+Deterministic synthetic depth, infrared and color (YUY2) frames for testing and
+benchmarking without a Kinect. Same sizes and formats as the sensor.
+
+A fixed number of distinct frames is rendered up front (a box moving over a
+sloped background) and then cycled, so producing a frame costs nothing and
+frame i always has the same content.
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+
+typedef INT64 TIMESPAN;	// As in Kinect.h
+
+static const int SYNTHETIC_WIDTH = 512;
+static const int SYNTHETIC_HEIGHT = 424;
+static const int SYNTHETIC_COLOR_WIDTH = 1920;
+static const int SYNTHETIC_COLOR_HEIGHT = 1080;
+static const int SYNTHETIC_DEFAULT_DISTINCT_FRAMES = 16;
+
+// 30 FPS in RelativeTime 100ns ticks
+static const TIMESPAN SYNTHETIC_FRAME_TICKS = 333333;
+
+class SyntheticSource
+{
+public:
+	explicit SyntheticSource(int numDistinctFrames = SYNTHETIC_DEFAULT_DISTINCT_FRAMES);
+
+	const UINT16* Depth(int i) const;
+	const UINT16* Infra(int i) const;
+	const BYTE* Color(int i) const;		// YUY2
+
+	static TIMESPAN RelativeTime(int i) { return i * SYNTHETIC_FRAME_TICKS; }
+
+	static int DepthPixels() { return SYNTHETIC_WIDTH * SYNTHETIC_HEIGHT; }
+	static int ColorBytes() { return SYNTHETIC_COLOR_WIDTH * SYNTHETIC_COLOR_HEIGHT * 2; }
+
+private:
+	int numFrames;
+	std::vector<UINT16> depth;
+	std::vector<UINT16> infra;
+	std::vector<BYTE> color;
+};
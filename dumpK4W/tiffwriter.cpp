@@ -0,0 +1,269 @@
+/*
+TIFF encoding to memory. See tiffwriter.h
+See main.cpp for license information.
+*/
+
+#include "tiffwriter.h"
+
+#include <cstring>
+
+#include <opencv2/highgui/highgui.hpp>
+
+// TIFF tags and field types used
+enum
+{
+	TIFF_SHORT = 3,
+	TIFF_LONG = 4,
+
+	TAG_IMAGE_WIDTH = 256,
+	TAG_IMAGE_LENGTH = 257,
+	TAG_BITS_PER_SAMPLE = 258,
+	TAG_COMPRESSION = 259,
+	TAG_PHOTOMETRIC = 262,
+	TAG_STRIP_OFFSETS = 273,
+	TAG_SAMPLES_PER_PIXEL = 277,
+	TAG_ROWS_PER_STRIP = 278,
+	TAG_STRIP_BYTE_COUNTS = 279,
+	TAG_PLANAR_CONFIG = 284,
+	TAG_PREDICTOR = 317
+};
+
+static const int TIFF_NUM_TAGS = 11;
+static const UINT32 TIFF_IFD_OFFSET = 8;	// Right after the header
+static const UINT32 TIFF_IFD_BYTES = 2 + TIFF_NUM_TAGS * 12 + 4;
+static const UINT32 TIFF_HEADER_BYTES = TIFF_IFD_OFFSET + TIFF_IFD_BYTES + 3 * 2 + 2;	// Up to the pixels
+
+// LZW as in the TIFF 6.0 spec (and libtiff): codes MSB first, 9 to 12 bits
+static const int LZW_CLEAR = 256;
+static const int LZW_EOI = 257;
+static const int LZW_FIRST = 258;
+static const int LZW_MIN_BITS = 9;
+static const int LZW_FULL = 4094;			// Table is cleared when the next code would be this
+static const int LZW_HASH_BITS = 13;		// Twice the table, so probes stay short
+static const int LZW_HASH_SIZE = 1 << LZW_HASH_BITS;
+
+static void Put16(BYTE *p, UINT16 v)
+{
+	p[0] = (BYTE)v;
+	p[1] = (BYTE)(v >> 8);
+}
+
+static void Put32(BYTE *p, UINT32 v)
+{
+	Put16(p, (UINT16)v);
+	Put16(p + 2, (UINT16)(v >> 16));
+}
+
+// Tags must be in ascending order. Values of up to 4 bytes are stored in the entry itself
+static BYTE* PutTag(BYTE *p, UINT16 tag, UINT16 type, UINT32 count, UINT32 value)
+{
+	Put16(p, tag);
+	Put16(p + 2, type);
+	Put32(p + 4, count);
+	if(type == TIFF_SHORT && count == 1) {
+		Put16(p + 8, (UINT16)value);
+		Put16(p + 10, 0);
+	}
+	else
+		Put32(p + 8, value);
+	return p + 12;
+}
+
+// Byte at a time LZW encoder. Lives on the stack of EncodeTiff() (about 48KB), so it doesn't allocate
+class LzwEncoder
+{
+public:
+	explicit LzwEncoder(BYTE *out)
+		: out(out), bits(0), numBits(0), codeBits(LZW_MIN_BITS), nextCode(LZW_FIRST), prefix(-1)
+	{
+		ClearTable();
+		PutCode(LZW_CLEAR);
+	}
+
+	void Put(BYTE c)
+	{
+		if(prefix < 0) {
+			prefix = c;
+			return;
+		}
+		// Table keys are prefix code and byte, + 1 so 0 marks a free slot
+		UINT32 key = ((UINT32)prefix << 8 | c) + 1;
+		UINT32 h = (key * 2654435761u) >> (32 - LZW_HASH_BITS);
+		while(keys[h]) {
+			if(keys[h] == key) {
+				prefix = codes[h];
+				return;
+			}
+			h = (h + 1) & (LZW_HASH_SIZE - 1);
+		}
+		PutCode(prefix);
+		keys[h] = key;
+		codes[h] = (UINT16)nextCode;
+		AddedCode();
+		prefix = c;
+	}
+
+	// Returns the end of the output
+	BYTE* Finish()
+	{
+		if(prefix >= 0) {
+			PutCode(prefix);
+			AddedCode();	// The decoder adds an entry for it too, which can change the code size
+		}
+		PutCode(LZW_EOI);
+		if(numBits > 0)
+			*out++ = (BYTE)(bits << (8 - numBits));
+		return out;
+	}
+
+private:
+	void PutCode(int code)
+	{
+		bits = bits << codeBits | (UINT32)code;
+		numBits += codeBits;
+		while(numBits >= 8)
+		{
+			numBits -= 8;
+			*out++ = (BYTE)(bits >> numBits);
+		}
+	}
+
+	// Codes get a bit longer once the table outgrows them, and the table is cleared when full.
+	// Same points as libtiff, which with the decoder one entry behind is TIFF's "early change"
+	void AddedCode()
+	{
+		++nextCode;
+		if(nextCode == LZW_FULL) {
+			PutCode(LZW_CLEAR);
+			ClearTable();
+		}
+		else if(nextCode > (1 << codeBits) - 1)
+			++codeBits;
+	}
+
+	void ClearTable()
+	{
+		memset(keys, 0, sizeof(keys));
+		codeBits = LZW_MIN_BITS;
+		nextCode = LZW_FIRST;
+	}
+
+	BYTE *out;
+	UINT32 bits;		// Not yet written, numBits of them
+	int numBits;
+	int codeBits;
+	int nextCode;
+	int prefix;			// Code of the string matched so far, -1 at the start
+	UINT32 keys[LZW_HASH_SIZE];
+	UINT16 codes[LZW_HASH_SIZE];
+
+	LzwEncoder(const LzwEncoder&);
+	LzwEncoder& operator=(const LzwEncoder&);
+};
+
+size_t TiffMaxBytes(int width, int height, int elemBytes)
+{
+	// At worst a 12 bit code per byte, plus the clear codes
+	size_t dataBytes = (size_t)width * height * elemBytes;
+	return TIFF_HEADER_BYTES + dataBytes * 3 / 2 + dataBytes / 1024 + 16;
+}
+
+bool EncodeTiff(const cv::Mat &image, std::vector<BYTE> &out)
+{
+	int type = image.type();
+	if(type != CV_8UC1 && type != CV_16UC1 && type != CV_8UC3)
+		return false;
+
+	const UINT32 width = image.cols;
+	const UINT32 height = image.rows;
+	const UINT16 channels = (UINT16)image.channels();
+	const UINT16 bits = image.depth() == CV_16U ? 16 : 8;
+
+	// Header, IFD, BitsPerSample array (RGB only), pixels
+	const UINT32 bitsOffset = TIFF_IFD_OFFSET + TIFF_IFD_BYTES;
+	const UINT32 dataOffset = TIFF_HEADER_BYTES;
+	out.resize(TiffMaxBytes(width, height, (int)image.elemSize()));
+	BYTE *p = &out[0];
+	memset(p, 0, dataOffset);
+
+	// Pixels first, the strip's size goes in the IFD. Horizontal differencing (predictor 2) is
+	// per sample: 16 bit samples are differenced as numbers then written little endian, RGB per channel
+	LzwEncoder lzw(p + dataOffset);
+	for(UINT32 y = 0; y < height; ++y)
+	{
+		if(bits == 16) {
+			const UINT16 *src = image.ptr<UINT16>(y);
+			UINT16 last = 0;
+			for(UINT32 x = 0; x < width; ++x)
+			{
+				UINT16 delta = (UINT16)(src[x] - last);
+				lzw.Put((BYTE)delta);
+				lzw.Put((BYTE)(delta >> 8));
+				last = src[x];
+			}
+		}
+		else if(channels == 3) {
+			const BYTE *src = image.ptr<BYTE>(y);
+			BYTE lastR = 0, lastG = 0, lastB = 0;
+			for(UINT32 x = 0; x < width; ++x, src += 3)
+			{
+				lzw.Put((BYTE)(src[2] - lastR));
+				lzw.Put((BYTE)(src[1] - lastG));
+				lzw.Put((BYTE)(src[0] - lastB));
+				lastR = src[2];
+				lastG = src[1];
+				lastB = src[0];
+			}
+		}
+		else {
+			const BYTE *src = image.ptr<BYTE>(y);
+			BYTE last = 0;
+			for(UINT32 x = 0; x < width; ++x)
+			{
+				lzw.Put((BYTE)(src[x] - last));
+				last = src[x];
+			}
+		}
+	}
+	const UINT32 dataBytes = (UINT32)(lzw.Finish() - (p + dataOffset));
+	out.resize(dataOffset + dataBytes);	// Shrinking keeps the capacity
+
+	p[0] = 'I';
+	p[1] = 'I';
+	Put16(p + 2, 42);
+	Put32(p + 4, TIFF_IFD_OFFSET);
+
+	BYTE *tag = p + TIFF_IFD_OFFSET;
+	Put16(tag, TIFF_NUM_TAGS);
+	tag += 2;
+	tag = PutTag(tag, TAG_IMAGE_WIDTH, TIFF_LONG, 1, width);
+	tag = PutTag(tag, TAG_IMAGE_LENGTH, TIFF_LONG, 1, height);
+	tag = PutTag(tag, TAG_BITS_PER_SAMPLE, TIFF_SHORT, channels, channels > 1 ? bitsOffset : bits);
+	tag = PutTag(tag, TAG_COMPRESSION, TIFF_SHORT, 1, 5);						// LZW
+	tag = PutTag(tag, TAG_PHOTOMETRIC, TIFF_SHORT, 1, channels > 1 ? 2 : 1);	// RGB or BlackIsZero
+	tag = PutTag(tag, TAG_STRIP_OFFSETS, TIFF_LONG, 1, dataOffset);
+	tag = PutTag(tag, TAG_SAMPLES_PER_PIXEL, TIFF_SHORT, 1, channels);
+	tag = PutTag(tag, TAG_ROWS_PER_STRIP, TIFF_LONG, 1, height);
+	tag = PutTag(tag, TAG_STRIP_BYTE_COUNTS, TIFF_LONG, 1, dataBytes);
+	tag = PutTag(tag, TAG_PLANAR_CONFIG, TIFF_SHORT, 1, 1);					// Interleaved
+	tag = PutTag(tag, TAG_PREDICTOR, TIFF_SHORT, 1, 2);						// Horizontal differencing
+	Put32(tag, 0);	// No next IFD
+
+	for(UINT16 c = 0; channels > 1 && c < channels; ++c)
+		Put16(p + bitsOffset + c * 2, bits);
+	return true;
+}
+
+void SaveImage(IoScheduler *io, const char *filename, const cv::Mat &image)
+{
+	if(!io) {
+		cv::imwrite(filename, image);
+		return;
+	}
+	IoBuffer *file = io->Acquire();
+	strcpy_s(file->filename, MAX_PATH, filename);
+	if(EncodeTiff(image, file->data))
+		io->Submit(file);
+	else
+		io->Discard(file, "Unable to encode");
+}
@@ -0,0 +1,33 @@
+/*
+TIFF encoding to memory, so the dump can hand finished files to the I/O
+scheduler (see iosched.h) instead of having every writer thread hit the
+disk with imwrite(). cv::imencode can't be used for this: OpenCV 2.4 built
+with libtiff encodes through a temp file, which writes every frame twice.
+
+Writes the same kind of file as imwrite: single strip little endian TIFFs
+of 8 or 16 bit gray and 8 bit BGR images (stored as RGB), LZW compressed
+with the horizontal differencing predictor. cv::imread and other TIFF
+readers load them as usual.
+
+See main.cpp for license information.
+*/
+
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "iosched.h"
+
+// Largest file EncodeTiff() makes for a width x height image of elemBytes per pixel
+size_t TiffMaxBytes(int width, int height, int elemBytes);
+
+// image is CV_8UC1, CV_16UC1 or CV_8UC3 (BGR). out is replaced by the file contents and keeps
+// its capacity, so encoding into a reused buffer doesn't allocate. Returns false for other types
+bool EncodeTiff(const cv::Mat &image, std::vector<BYTE> &out);
+
+// Writes image as a tiff: encoded into a buffer from io's pool and queued, or written straight away
+// with imwrite if io is NULL. A file that can't be encoded is reported and counted in io->Errors()
+void SaveImage(IoScheduler *io, const char *filename, const cv::Mat &image);